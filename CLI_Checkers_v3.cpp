@@ -21,9 +21,832 @@
     Author:  Steelstring94
 */
 #include <iostream>
+#include <fstream>
 #include <limits>
+#include <cstring>
+#include <cstdlib>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <cmath>
+#include <streambuf>
+#include <sstream>
+#include <cerrno>
+#include <csignal>
+//--serve is built on epoll, eventfd and signalfd, --journal on
+//fdatasync, and --pin and --huge-pages on Linux's processor
+//affinity, NUMA topology and huge pages.  Only Linux has them;
+//elsewhere they are left out.
+#ifdef __linux__
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/select.h>
+#include <unistd.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
 using namespace std;
 
+//Building with -DCHECKERS_STATS compiles in counters and
+//timers around the hot paths of the program (move validation,
+//double jump detection, drawing the board and the computer
+//player's search).  Without it,
+//the STAT_ macros below expand to nothing and cost nothing.
+#ifdef CHECKERS_STATS
+//Every timed phase of the program has an entry here,
+//which indexes statPhaseNames and the calls and nanos
+//tables of a StatTable.
+enum StatPhase
+  {
+    PHASE_VALIDMOVE,
+    PHASE_DOUBLEJUMP,
+    PHASE_RENDER,
+    PHASE_MOVEGEN,
+    PHASE_EVALUATE,
+    PHASE_EVAL_CACHE,
+    PHASE_SEARCH,
+    NUM_PHASES
+  };
+
+//Plain event counters that are not tied to a timer.
+enum StatCounter
+  {
+    COUNT_MOVES_ACCEPTED,
+    COUNT_JUMPS_ACCEPTED,
+    COUNT_DOUBLEJUMPS_FOUND,
+    COUNT_NODES,
+    COUNT_MOVES_GENERATED,
+    COUNT_TT_PROBES,
+    COUNT_TT_HITS,
+    COUNT_TT_STORES,
+    COUNT_BETA_CUTOFFS,
+    COUNT_FIRST_MOVE_CUTOFFS,
+    COUNT_PLAYOUTS,
+    COUNT_PVS_RESEARCHES,
+    COUNT_LMR_REDUCTIONS,
+    COUNT_LMR_RESEARCHES,
+    COUNT_PROBCUTS,
+    COUNT_ASPIRATION_FAILS,
+    COUNT_EVAL_CACHE_PROBES,
+    COUNT_EVAL_CACHE_HITS,
+    NUM_COUNTERS
+  };
+
+const char *statPhaseNames[NUM_PHASES] = { "validMove", "isDoubleJumpAvailable", "drawBoard", "generateMoves", "evaluate", "evalCache", "think" };
+const char *statCounterNames[NUM_COUNTERS] = { "moves_accepted", "jumps_accepted", "double_jumps_found", "nodes", "moves_generated",
+					       "tt_probes", "tt_hits", "tt_stores", "beta_cutoffs", "first_move_cutoffs", "playouts",
+					       "pvs_researches", "lmr_reductions", "lmr_researches", "probcuts", "aspiration_fails",
+					       "eval_cache_probes", "eval_cache_hits" };
+
+//Each thread counts into a StatTable of its own, so that
+//threads searching side by side never fight over a cache line,
+//and printStats() adds the tables up.  Only the owning thread
+//writes to a table, with a plain load and store; the entries
+//are atomic only so that a thread still running can be read.
+struct StatTable
+{
+  atomic<unsigned long long> calls[NUM_PHASES];
+  atomic<unsigned long long> nanos[NUM_PHASES];
+  atomic<unsigned long long> counters[NUM_COUNTERS];
+};
+
+//The tables of the threads that are running, and what the
+//threads that have exited counted.
+vector<StatTable *> statTables;
+StatTable statFinished;
+mutex statTablesLock;
+
+//A thread's table is kept in a StatRegistration, which lists
+//it in statTables when the thread first counts something and
+//folds it into statFinished when the thread exits.
+struct StatRegistration
+{
+  StatTable table;
+
+  StatRegistration() : table()
+  {
+    lock_guard<mutex> lock(statTablesLock);
+    statTables.push_back(&table);
+  }
+
+  ~StatRegistration()
+  {
+    lock_guard<mutex> lock(statTablesLock);
+
+    for(int i = 0; i < NUM_PHASES; i++)
+      {
+	statFinished.calls[i] += table.calls[i];
+	statFinished.nanos[i] += table.nanos[i];
+      }
+    for(int i = 0; i < NUM_COUNTERS; i++)
+      statFinished.counters[i] += table.counters[i];
+
+    statTables.erase(find(statTables.begin(), statTables.end(), &table));
+  }
+};
+
+thread_local StatTable *statTable = NULL;
+
+//Returns the calling thread's table, registering it on first
+//use.
+inline StatTable &threadStats()
+{
+  if(!statTable)
+    {
+      thread_local StatRegistration registration;
+
+      statTable = &registration.table;
+    }
+
+  return *statTable;
+}
+
+//statAdd() adds n to an entry of the calling thread's own
+//table.
+inline void statAdd(atomic<unsigned long long> &entry, unsigned long long n)
+{
+  entry.store(entry.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+//A StatTimer adds the time between its construction and
+//its destruction to the given phase, so a single STAT_TIME()
+//at the top of a function covers every one of its return paths.
+struct StatTimer
+{
+  StatPhase phase;
+  chrono::steady_clock::time_point start;
+
+  StatTimer(StatPhase p) : phase(p), start(chrono::steady_clock::now()) {}
+
+  ~StatTimer()
+  {
+    StatTable &table = threadStats();
+
+    statAdd(table.calls[phase], 1);
+    statAdd(table.nanos[phase], chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+  }
+};
+
+#define STAT_TIME(phase) StatTimer statTimer_(phase)
+#define STAT_COUNT(counter) statAdd(threadStats().counters[counter], 1)
+#define STAT_ADD(counter, n) statAdd(threadStats().counters[counter], n)
+#else
+#define STAT_TIME(phase) ((void) 0)
+#define STAT_COUNT(counter) ((void) 0)
+#define STAT_ADD(counter, n) ((void) 0)
+#endif
+
+//If set (by --stats-json), printStats() also writes
+//its report as JSON to this file.
+const char *statsJsonFile = NULL;
+
+//Tracing records named spans of time (a turn, waiting for
+//input, drawing the board) and writes them at exit in the
+//Chrome trace-event format, which chrome://tracing and
+//Perfetto can load.  It is switched on at run time with
+//--trace FILE; when it is off, a TRACE_SCOPE costs a
+//single test of traceFile.
+const char *traceFile = NULL;
+
+//One recorded span.  Names must be string literals,
+//because only the pointer is kept.
+struct TraceEvent
+{
+  const char *name;
+  long long start;
+  long long duration;
+};
+
+//Each thread writes to its own TraceBuffer, so recording
+//needs no locking.  The buffer is a ring: once it is full,
+//the oldest events are overwritten, so the file always
+//holds the most recent stretch of the run.
+const int TRACE_BUFFER_SIZE = 1 << 15;
+
+struct TraceBuffer
+{
+  int thread;
+  bool inUse;
+  unsigned long long count;
+  TraceEvent events[TRACE_BUFFER_SIZE];
+};
+
+//Every buffer handed out, for writeTrace() to collect.  A
+//thread takes a buffer the first time it records and gives it
+//back when it exits, for the next thread to carry on with, so
+//there are never more buffers than threads running at once.
+//The mutex is only taken when a thread takes or gives back a
+//buffer.
+vector<TraceBuffer *> traceBuffers;
+mutex traceBuffersLock;
+
+//Gives the calling thread's buffer back when the thread exits.
+struct TraceRelease
+{
+  TraceBuffer *buffer;
+
+  ~TraceRelease()
+  {
+    lock_guard<mutex> lock(traceBuffersLock);
+    buffer->inUse = false;
+  }
+};
+
+//Microseconds since the program started, which is the
+//unit the trace format expects.
+long long traceNow()
+{
+  static const chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+
+  return chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - epoch).count();
+}
+
+//Returns the calling thread's buffer, taking one no thread is
+//using, or creating and registering a new one, on first use.
+TraceBuffer *traceBuffer()
+{
+  thread_local TraceBuffer *buffer = NULL;
+
+  if(!buffer)
+    {
+      thread_local TraceRelease release;
+      lock_guard<mutex> lock(traceBuffersLock);
+
+      for(size_t i = 0; i < traceBuffers.size() && !buffer; i++)
+	if(!traceBuffers[i]->inUse)
+	  buffer = traceBuffers[i];
+
+      if(!buffer)
+	{
+	  buffer = new TraceBuffer;
+	  buffer->count = 0;
+	  buffer->thread = traceBuffers.size() + 1;
+	  traceBuffers.push_back(buffer);
+	}
+
+      buffer->inUse = true;
+      release.buffer = buffer;
+    }
+
+  return buffer;
+}
+
+//A TraceScope records one span covering its own lifetime.
+struct TraceScope
+{
+  const char *name;
+  long long start;
+
+  TraceScope(const char *n) : name(n), start(traceFile ? traceNow() : 0) {}
+
+  ~TraceScope()
+  {
+    if(!traceFile)
+      return;
+
+    TraceBuffer *buffer = traceBuffer();
+    TraceEvent &event = buffer->events[buffer->count % TRACE_BUFFER_SIZE];
+
+    event.name = name;
+    event.start = start;
+    event.duration = traceNow() - start;
+    buffer->count++;
+  }
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope_, __LINE__)(name)
+
+//Set by --memory-budget, in bytes.  With a budget, the big
+//tables the program needs (transposition tables, tree and
+//proof node pools, batch arrays) are all carved out of one
+//arena, allocated and touched at startup, so that the process
+//cannot grow past the budget and nothing is allocated in the
+//middle of a move.  Without one, they come from the heap.
+size_t memoryBudget = 0;
+
+//An eighth of the budget is kept out of the arena for what
+//the program needs besides its tables: its code, thread
+//stacks and stream buffers.
+const size_t MEMORY_RESERVE_FRACTION = 8;
+
+//Blocks start on a cache line boundary.
+const size_t BLOCK_ALIGNMENT = 64;
+
+//The arena is arenaSize bytes at arena, of which the first
+//arenaUsed have been handed out.  Match threads set up their
+//engines at the same time, hence arenaLock.
+char *arena = NULL;
+size_t arenaSize = 0;
+size_t arenaUsed = 0;
+mutex arenaLock;
+
+//How much memory went to each purpose, in how many blocks,
+//for printMemoryReport().
+struct MemoryUse
+{
+  const char *purpose;
+  size_t bytes;
+  int blocks;
+};
+
+const int MAX_MEMORY_USES = 16;
+MemoryUse memoryUses[MAX_MEMORY_USES];
+int memoryUseCount = 0;
+
+//How worker threads are placed on processors, set by --pin:
+//left to the kernel, pinned one to a processor, or pinned one
+//to a NUMA node, where they may run on any of its processors.
+//Thread i of each mode always lands in the same place.
+enum ThreadPlacement
+  {
+    PLACE_NONE,
+    PLACE_CORES,
+    PLACE_NODES
+  };
+
+ThreadPlacement threadPlacement = PLACE_NONE;
+
+//The processors the program may run on, as read by
+//readTopology(): nodeCpus[n] lists those of NUMA node n, and
+//cpuOrder all of them in the order PLACE_CORES deals them out.
+vector<vector<int> > nodeCpus;
+vector<int> cpuOrder;
+
+//Whether big tables are backed by huge pages, set by
+//--huge-pages: not at all, by transparent huge pages, or by
+//explicit ones from the kernel's reserved pool (falling back
+//to transparent ones when there are not enough).
+enum HugePages
+  {
+    HUGE_PAGES_NONE,
+    HUGE_PAGES_TRANSPARENT,
+    HUGE_PAGES_EXPLICIT
+  };
+
+HugePages hugePages = HUGE_PAGES_NONE;
+
+//The size of a huge page on x86-64, and the smallest block
+//worth putting on them.
+const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+//The largest number of squares a single move can visit: the
+//square it starts from plus one landing square for each of
+//the twelve opposing pieces it could jump.
+const int MAX_MOVE_PATH = 13;
+
+//Room for every move the side to move can possibly have.
+const int MAX_MOVES = 192;
+
+//A whole turn as the computer player sees it: the squares the
+//piece visits, as (x, y) pairs, starting with the square it
+//moves from.  A plain move or a single jump has a length of 2,
+//and each further jump of a double jump adds one square.
+struct Move
+{
+  int path[MAX_MOVE_PATH][2];
+  int length;
+};
+
+//Everything main() keeps track of during a game, gathered
+//together so that the computer player can copy it.
+struct Position
+{
+  int grid[8][8];
+  int turn;
+  int p1Pieces;
+  int p2Pieces;
+};
+
+//Scores are in hundredths of a standard piece, from the point
+//of view of the side to move.  A won position scores WIN_SCORE
+//less the number of plies it takes to win, so anything beyond
+//WIN_BOUND is a forced win or loss.
+const int WIN_SCORE = 30000;
+const int WIN_BOUND = WIN_SCORE - 1000;
+const int INFINITE_SCORE = WIN_SCORE + 1;
+
+//What a transposition table score says about the true score.
+enum Bound
+  {
+    BOUND_EXACT,
+    BOUND_LOWER,
+    BOUND_UPPER
+  };
+
+//One entry of the computer player's transposition table,
+//which remembers what earlier searches found out about a
+//position.  Entries are for canonical positions (see
+//canonicalize()), so that a position and its mirror image
+//share one.  bestFrom and bestTo are the squares, as x * 8 + y
+//in the canonical position, that the best move found starts
+//and ends on.
+struct TableEntry
+{
+  unsigned long long key;
+  int score;
+  signed char depth;
+  unsigned char bound;
+  unsigned char bestFrom;
+  unsigned char bestTo;
+};
+
+//One entry of a computer player's evaluation cache: the static
+//evaluation of the position whose Zobrist hash has check as its
+//top 32 bits (its bottom bits pick the entry).
+struct EvalEntry
+{
+  unsigned int check;
+  int score;
+};
+
+//The evaluation network's inputs: one for each of four kinds
+//of piece (the side's own standard pieces, the other side's,
+//its own Kings and the other side's) on each of the 32 playable
+//squares, input kind * 32 + square.  The network looks at the
+//board from both sides; from player 2's, square numbers are
+//turned round (31 - square, numbering as in a Snapshot).
+const int NETWORK_INPUTS = 128;
+
+//The widths of the network's two hidden layers.  The first is
+//computed for each side and the two halves put side by side,
+//the side to move's first.
+const int NETWORK_FIRST = 64;
+const int NETWORK_SECOND = 32;
+
+//The network's output divided by this is the score.
+const int NETWORK_OUTPUT_SCALE = 16;
+
+//A quantized evaluation network, as loaded by loadNetwork().
+//With x the inputs (0 or 1), each side's first layer is
+//a = firstBiases + x * firstWeights, in 16 bits, clipped to
+//0..127 and kept in 8 bits.  The second layer is b =
+//(secondBiases + secondWeights * a) >> 6, again clipped to
+//0..127, and the output outputBias + outputWeights * b.
+//Weight rows are cache-line aligned for the SIMD kernel.
+struct Network
+{
+  alignas(64) short firstWeights[NETWORK_INPUTS][NETWORK_FIRST];
+  short firstBiases[NETWORK_FIRST];
+  alignas(64) signed char secondWeights[NETWORK_SECOND][2 * NETWORK_FIRST];
+  int secondBiases[NETWORK_SECOND];
+  signed char outputWeights[NETWORK_SECOND];
+  int outputBias;
+};
+
+//The first layer of the network for one position, from each
+//side: values[0] from player 1's, values[1] from player 2's.
+//A move changes only the inputs of the squares it touches, so
+//updateAccumulator() works out a child's from its parent's.
+struct Accumulator
+{
+  alignas(64) short values[2][NETWORK_FIRST];
+};
+
+//The network loaded with --network, if any.
+Network *network = NULL;
+
+//The deepest a search goes: 64 plies of alpha-beta, then one
+//jump per piece there is to take in quiesce().
+const int MAX_SEARCH_PLY = 96;
+
+//The board as three 64-bit masks, with bit x * 8 + y standing
+//for grid[x][y]: pieces[0] holds player 1's pieces, pieces[1]
+//player 2's, and kings the Kings of both.  Much faster to play
+//random games on than the grid.
+struct Bitboard
+{
+  unsigned long long pieces[2];
+  unsigned long long kings;
+  int turn;
+};
+
+//A move on a Bitboard: the square the piece leaves, the square
+//it ends up on, and every piece it jumps on the way.
+struct BitMove
+{
+  unsigned long long from;
+  unsigned long long to;
+  unsigned long long captured;
+};
+
+//How many of a game's most recent moves a Snapshot keeps.
+const int SNAPSHOT_HISTORY = 22;
+
+//Marks the start of a Snapshot ("CK" in a file).
+const unsigned short SNAPSHOT_MAGIC = 0x4B43;
+
+//The moves of a game so far, as far as a Snapshot keeps them:
+//plies is how many have been played, and moves holds the last
+//length of them, packed by packMove(), oldest first.
+struct GameHistory
+{
+  int plies;
+  int length;
+  unsigned short moves[SNAPSHOT_HISTORY];
+};
+
+//A game packed into 64 bytes, for saving it and carrying on
+//later.  The board is kept as masks of the 32 playable
+//squares, with bit x * 4 + y / 2 standing for grid[x][y]:
+//pieces[0] holds player 1's pieces, pieces[1] player 2's, and
+//kings the Kings of both.  computer is the player the computer
+//plays, or 0.  Snapshots are written in the byte order of the
+//machine that makes them.
+struct Snapshot
+{
+  unsigned int pieces[2];
+  unsigned int kings;
+  unsigned short magic;
+  unsigned short plies;
+  unsigned char turn;
+  unsigned char computer;
+  unsigned char historyLength;
+  unsigned char unused;
+  unsigned short history[SNAPSHOT_HISTORY];
+};
+
+static_assert(sizeof(Snapshot) == 64, "a Snapshot should be 64 bytes");
+
+//The kinds of JournalRecord: a game starting (or carrying on
+//from where it stood in an earlier journal file), a move
+//played in it, and its end.
+enum JournalRecordType
+  {
+    JOURNAL_START = 1,
+    JOURNAL_MOVE,
+    JOURNAL_END
+  };
+
+//One entry of the game journal, 32 bytes, so that a record is
+//never split across a disk sector.  checksum is the FNV-1a hash
+//of the other 28 bytes, so that a record torn by a crash is
+//recognised.  game tells the games being journaled at once
+//apart.  For JOURNAL_START, data holds the game's pieces and
+//Kings as a Snapshot keeps them, then its plies (in 16 bits),
+//turn and computer player.  For JOURNAL_MOVE, count is the
+//length of the move and data the playable squares it visits,
+//numbered as in a Snapshot.  For JOURNAL_END, count is the
+//winner, or 0 if the game was abandoned.  Records are written
+//in the byte order of the machine that makes them.
+struct JournalRecord
+{
+  unsigned int checksum;
+  unsigned char type;
+  unsigned char count;
+  unsigned short unused;
+  unsigned long long game;
+  unsigned char data[16];
+};
+
+static_assert(sizeof(JournalRecord) == 32, "a JournalRecord should be 32 bytes");
+
+//A place in the journal's queue.  sequence says whose turn the
+//slot is, as described with journalPush().
+struct JournalSlot
+{
+  atomic<unsigned long long> sequence;
+  JournalRecord record;
+};
+
+//A game as the journal last saw it, for starting it afresh in
+//a new journal file and for --recover.
+struct JournalGame
+{
+  Position pos;
+  int computer;
+  GameHistory history;
+};
+
+//Everything the journal keeps.  Records go from the threads
+//playing games into slots, a ring of capacity places, without
+//locking: head is the number of records ever claimed, tail
+//the number the writer thread has taken out.  The writer
+//appends them to fd, bytes long so far, in batches of as many
+//as have piled up, syncing the file once per batch, and once
+//it has grown past rotateBytes renames it to file.rotation and
+//starts a new one.  Finding the ring empty, the writer sets
+//idle and waits on work, and the thread whose record it is
+//waiting for wakes it.  games holds the games in progress, and
+//those an earlier run left unfinished, and is the writer's
+//alone once it is running.
+struct Journal
+{
+  JournalSlot *slots;
+  size_t capacity;
+  alignas(64) atomic<unsigned long long> head;
+  alignas(64) unsigned long long tail;
+  atomic<bool> stopping;
+  atomic<bool> idle;
+  mutex lock;
+  condition_variable work;
+  atomic<unsigned long long> nextGame;
+  atomic<long long> records;
+  atomic<long long> commits;
+
+  string file;
+  int fd;
+  size_t bytes;
+  size_t rotateBytes;
+  int rotation;
+  bool failed;
+  map<unsigned long long, JournalGame> games;
+  thread writer;
+};
+
+//The journal opened with --journal, if any.
+Journal *journal = NULL;
+
+//One node of a Monte Carlo search tree.  Nodes are carved out
+//of the engine's preallocated pool, and a node's children sit
+//next to each other from firstChild on.  visits and score are
+//updated by all search threads at once; score is in half
+//points for the player who made move.  state is 0 until the
+//node is expanded, 1 while a thread is expanding it and 2
+//once its children are in place, or 3 if the pool ran out
+//when it was expanded, which leaves it a leaf for good.
+struct MctsNode
+{
+  atomic<int> visits;
+  atomic<int> score;
+  atomic<int> state;
+  int firstChild;
+  int childCount;
+  BitMove move;
+};
+
+struct Engine;
+
+//The threads an MCTS player with threads > 1 searches with,
+//besides the one that calls think().  They are started on the
+//player's first move and wait between moves, so that no move
+//pays for starting and joining them, and are stopped when the
+//engine goes.  Each move bumps generation to set them going on
+//board; running counts those still busy with it.
+struct MctsPool
+{
+  Engine *engine;
+  vector<thread> threads;
+  mutex lock;
+  condition_variable start;
+  condition_variable finished;
+  long long generation;
+  int running;
+  bool stopping;
+  Bitboard board;
+  atomic<long long> iterations;
+
+  ~MctsPool();
+};
+
+//Thousands of independent games at once, stored as parallel
+//arrays (one entry per game) rather than one Position each, so
+//that each step of the games is a tight loop over plain masks
+//and counters that the compiler can vectorize.  The masks are
+//laid out as in a Bitboard.  pending holds the piece partway
+//through a double jump, whose side moves again, or 0.  result
+//is 0 while a game is going, the winner (1 or 2) once it is
+//won, and 3 for a draw.  The step and jump arrays hold, for
+//each of the four directions, the landing squares of the moves
+//generated for each game, and the move arrays the move chosen.
+//The arrays all live in one block with room for capacity
+//games, of which the first size are in use.
+struct GameBatch
+{
+  int size;
+  int capacity;
+  unsigned long long *pieces1, *pieces2, *kings, *pending;
+  int *turn, *p1Pieces, *p2Pieces, *plies, *result;
+  unsigned long long *random;
+
+  unsigned long long *steps[4], *jumps[4];
+  unsigned long long *moveFrom, *moveTo, *moveCaptured;
+};
+
+//The settings that tell one computer player from another.
+//readEngineConfig() explains each of them.
+struct EngineConfig
+{
+  int depth;
+  long long nodes;
+  int tableBits;
+  int kingValue;
+  bool mcts;
+  long long playouts;
+  int moveTime;
+  int threads;
+  long long treeNodes;
+  bool pvs;
+  int aspiration;
+  bool lmr;
+  bool probcut;
+  bool useNetwork;
+  int evalCacheBits;
+};
+
+//A computer player: its settings, its transposition table of
+//tableSize entries, and the bookkeeping of the search in
+//progress.  An MCTS player has a pool of tree nodes instead
+//of a table, which is allocated once and reused for every
+//move; treeTop is the next unused node in it.  Its other
+//search threads are in pool.
+//
+//If poll is set, the search calls it every few thousand nodes,
+//on the thread doing the search, so that a single-threaded
+//program can keep its screen and keyboard going while the
+//computer thinks.  pollContext is for poll to use as it likes.
+//Setting moveNow makes the engine stop and play the best move
+//it has found so far.  started is when the search began, and
+//iteration the depth it is working on.  A player that uses
+//the evaluation network keeps the network's first layer for
+//each ply of the search in accumulators.  One with an
+//evaluation cache of evalCacheSize entries keeps the hash of
+//the position at each ply in evalKeys, to look it up with.
+//Each search thread has an engine, and so a cache, of its own.
+struct Engine
+{
+  EngineConfig config;
+  TableEntry *table;
+  size_t tableSize;
+  long long nodes;
+  long long nodeLimit;
+  bool stopped;
+  Move rootMove;
+  Accumulator *accumulators;
+  EvalEntry *evalCache;
+  size_t evalCacheSize;
+  unsigned long long *evalKeys;
+
+  MctsNode *tree;
+  atomic<long long> treeTop;
+  unique_ptr<MctsPool> pool;
+
+  void (*poll)(Engine &engine);
+  void *pollContext;
+  long long nextPoll;
+  bool moveNow;
+  int iteration;
+  chrono::steady_clock::time_point started;
+};
+
+//What showThinking() keeps between calls during one move of
+//the computer player: the last tenth of a second it drew the
+//clock for, and whether the player asked to quit.
+struct ThinkingDisplay
+{
+  long long drawn;
+  bool quit;
+};
+
+#if defined(__unix__) || defined(__APPLE__)
+//When the keyboard is a terminal, std::cin reads it through a
+//TerminalInput, which is how showThinking() gets to see what is
+//typed while the computer thinks without taking it from the
+//game.  text holds what has been read from the terminal and
+//not yet dropped; std::cin reads it from the get area.
+struct TerminalInput : public streambuf
+{
+  string text;
+
+  //poll() adds whatever has been typed to text, without
+  //waiting for more.
+  void poll();
+
+  //takeLine() removes the first whole line not yet read that
+  //is word, and returns false if there is none.
+  bool takeLine(const char *word);
+
+  int underflow();
+};
+
+TerminalInput terminalInput;
+#endif
+
 //drawHeader prints out the numbers and top border
 //line of the checkers board.
 void drawHeader();
@@ -109,8 +932,467 @@ void grantDoubleJump(int player, int &x, int &y, int grid[][8], int &pieces, int
 //to std::cout.
 void drawBoard(int grid[][8]);
 
-
-int main()
+//printStats() writes the collected counters and
+//timers as a text table to std::cerr and, if
+//statsJsonFile is set, as JSON to that file.  It is
+//registered with atexit() so that it runs however
+//the program ends.  Does nothing unless the program
+//was built with CHECKERS_STATS.
+void printStats();
+
+//initArena() allocates the arena for a budget of memoryBudget
+//bytes and touches every page of it, so that all of it is
+//resident from the start, unless threads are pinned: then
+//each page is left for the thread that uses it to touch, so
+//that it ends up on that thread's node.  Returns false if the
+//memory is not to be had.
+bool initArena();
+
+//allocateBlock() returns bytes of zeroed memory for purpose
+//(which must be a string literal), from the arena if there is
+//a budget and from the heap if not.  Blocks are never freed:
+//they hold tables that last as long as the program.  Running
+//out of budget ends the program.
+void *allocateBlock(size_t bytes, const char *purpose);
+
+//arenaAvailable() returns how many bytes of the arena have
+//not been handed out yet.
+size_t arenaAvailable();
+
+//printMemoryReport() writes to std::cerr how the budget was
+//split between the program's tables.  It is registered with
+//atexit() when there is a budget.
+void printMemoryReport();
+
+//mapMemory() maps bytes of zeroed memory straight from the
+//kernel for purpose, on huge pages as hugePages says, and
+//returns NULL if it cannot.  Its pages are not touched, so each
+//is placed on the NUMA node of the thread that first writes to
+//it.
+void *mapMemory(size_t bytes, const char *purpose);
+
+//readTopology() finds which processors the program may run on
+//and which NUMA node each is on, for placeThread().
+//placeThread() pins the calling thread, worker index of its
+//mode, as threadPlacement says.  reportPlacement() writes to
+//std::cerr how threads and tables will be placed.
+void readTopology();
+void placeThread(int index);
+void reportPlacement();
+
+//readPosition() fills grid and turn from a position
+//string: one character per playable square, 32 in all,
+//row by row from row 1, using . for an empty square,
+//x and o for standard pieces and X and O for Kings,
+//optionally followed by ":1" or ":2" for whose turn it
+//is (player 1 if left out).  Returns false, leaving grid
+//and turn untouched, if the string is malformed.
+bool readPosition(const char *text, int grid[][8], int &turn);
+
+//positionText() writes grid and turn as a position string
+//that readPosition() can read back, turn included.
+string positionText(int grid[][8], int turn);
+
+//countPieces() sets p1Pieces and p2Pieces to the number
+//of pieces each player has in grid, Kings included.
+void countPieces(int grid[][8], int &p1Pieces, int &p2Pieces);
+
+//startPosition() sets pos up as a new game, the same way
+//main() does.
+void startPosition(Position &pos);
+
+//generateMoves() fills moves with every move the side to move
+//has in pos, and returns how many there are.  Moves are found
+//by asking validMove() and isDoubleJumpAvailable(), so the
+//computer player plays by exactly the rules a person does:
+//jumping is never forced, and a double jump may be stopped
+//after any jump.  If jumpsOnly is true, only moves that jump
+//something are generated.  Jumps always come first.
+int generateMoves(Position &pos, Move moves[], bool jumpsOnly);
+
+//makeMove() plays move in pos, removing jumped pieces and
+//crowning Kings as main() and grantDoubleJump() do, and
+//passes the turn to the other player.
+void makeMove(Position &pos, const Move &move);
+
+//nextRandom() steps a xorshift64* generator.  state must
+//not be zero.
+unsigned long long nextRandom(unsigned long long &state);
+
+//initZobrist() fills in the random numbers hashPosition()
+//uses.  Called once at startup.
+void initZobrist();
+
+//hashPosition() returns a 64-bit Zobrist hash of pos.
+unsigned long long hashPosition(const Position &pos);
+
+//canonicalHash() returns the hash of pos's canonical form, which
+//the transposition table is keyed on, and sets flipped if that
+//form is pos turned round rather than pos itself.
+unsigned long long canonicalHash(const Position &pos, bool &flipped);
+
+//touchedSquares() fills squares with the squares move can
+//change, as (x, y) pairs: those on its path and those it jumps
+//over.  Returns how many there are.  A square may be listed
+//twice, as a King can pass the same square twice in a double
+//jump or end where it started.
+int touchedSquares(const Move &move, int squares[][2]);
+
+//hashChange() returns what to xor into the hashPosition() of
+//before to get that of after, when move takes one to the other:
+//the same hash, for a few squares' worth of work.
+unsigned long long hashChange(const Position &before, const Position &after, const Move &move);
+
+//evaluate() guesses the score of pos without searching,
+//from material and how far standard pieces have advanced.
+int evaluate(const Position &pos, const EngineConfig &config);
+
+//loadNetwork() reads an evaluation network from file into
+//network, and returns false if file does not hold one.  The
+//file is "CKNN" followed by each of Network's arrays in turn,
+//in little-endian byte order.
+bool loadNetwork(const char *file);
+
+//refreshAccumulator() works out the network's first layer for
+//pos from scratch.  updateAccumulator() works out to, the first
+//layer of after, the position move leads to from before, from
+//from, before's, looking only at the squares move touches.
+void refreshAccumulator(const Position &pos, Accumulator &accumulator);
+void updateAccumulator(const Position &before, const Position &after, const Move &move, const Accumulator &from, Accumulator &to);
+
+//networkEvaluate() runs the rest of the network on accumulator,
+//the first layer of a position with turn to move, and returns
+//its score for the side to move.  The second layer, where
+//nearly all the work is, runs on AVX2 if the processor has it.
+int networkEvaluate(const Accumulator &accumulator, int turn);
+
+//secondLayerScalar() and secondLayerAvx2() work out the
+//network's second layer, clipped, from the first layer from
+//the side to move's point of view, own, and from the other
+//side's, other.  They give the same answers.
+//pickSecondLayer() returns the one the processor can run
+//fastest, which is the one networkEvaluate() calls through
+//secondLayer.
+typedef void SecondLayer(const short own[], const short other[], int second[]);
+void secondLayerScalar(const short own[], const short other[], int second[]);
+#if defined(__x86_64__) || defined(__i386__)
+void secondLayerAvx2(const short own[], const short other[], int second[]);
+#endif
+SecondLayer *pickSecondLayer();
+
+SecondLayer *secondLayer = pickSecondLayer();
+
+//readEngineConfig() sets config from a comma-separated list of
+//key=value settings, leaving anything not mentioned at its
+//default: depth (deepest iteration, default 6), nodes (node
+//limit per move, 0 for none), ms (thinking time per move in
+//milliseconds, 0 for none), table (the transposition table
+//has 2^table entries, default 20) and king (the value of a
+//King, where a standard piece is 100; default 150).  mcts=1
+//switches to Monte Carlo tree search instead, which reads
+//playouts (playouts per move), ms (thinking time per move,
+//used instead of playouts if set), threads (search threads,
+//default 1) and tree (size of the node pool, default 1000000).
+//The alpha-beta search's refinements can each be switched off,
+//to measure what they are worth: pvs (principal variation
+//search), aspiration (the half-width of the aspiration window,
+//0 for none; default 40), lmr (late move reductions) and
+//probcut.  nn=1 evaluates with the loaded network instead of
+//evaluate().  evalcache gives each search thread a cache of
+//2^evalcache static evaluations (14 makes it 128 KB, to sit in
+//L2), or none if it is 0, the default.  Returns false if text
+//has an unknown key or a bad value, or asks for the network
+//when none is loaded.
+bool readEngineConfig(const char *text, EngineConfig &config);
+
+//initEngine() sets engine up with config and an empty
+//transposition table; clearEngine() empties the table
+//again, for a new game.
+void initEngine(Engine &engine, const EngineConfig &config);
+void clearEngine(Engine &engine);
+
+//engineBytes() returns how much memory initEngine() allocates
+//for an engine with config.  fitEngine() shrinks config's
+//transposition table, or an MCTS player's node pool, until
+//that is no more than bytes, and returns false if it cannot.
+size_t engineBytes(const EngineConfig &config);
+bool fitEngine(EngineConfig &config, size_t bytes);
+
+//think() runs an iterative-deepening alpha-beta search of pos
+//(or a Monte Carlo tree search, for an MCTS player) and sets
+//best to the move it prefers, returning its score.  If the
+//side to move has no moves, best has a length of 0.
+int think(Engine &engine, Position &pos, Move &best);
+
+//toBitboard() and fromBitboard() convert between a Position
+//and a Bitboard.
+void toBitboard(const Position &pos, Bitboard &board);
+void fromBitboard(const Bitboard &board, Position &pos);
+
+//toBitMove() turns move, a move in a position, into the
+//BitMove that does the same thing on a Bitboard.
+BitMove toBitMove(const Move &move);
+
+//applyBitMove() plays move on board, crowning a piece that
+//ends on the far row, and passes the turn.
+void applyBitMove(Bitboard &board, const BitMove &move);
+
+//flipBitboard() turns board through 180 degrees and swaps the
+//players' pieces and the turn.  The rules look the same from
+//either side of the board, so the flipped position plays
+//exactly like the original with the players' roles swapped:
+//the starting position flips into itself with the other player
+//to move.  canonicalize() flips board if it is player 2's turn,
+//so that a position and its flipped twin come out the same,
+//and returns whether it did.
+void flipBitboard(Bitboard &board);
+bool canonicalize(Bitboard &board);
+
+//playout() plays board out to the end with random moves, using
+//the Bitboard move generator, and returns the winner (1 or 2),
+//or 0 for a draw.  The moves are lightly guided: jumps are
+//preferred, and a piece that has jumped keeps jumping if it
+//can.  random is the state of the random number generator.
+int playout(Bitboard board, unsigned long long &random);
+
+//mctsThink() runs a tree-parallel Monte Carlo tree search of
+//pos on engine.config.threads threads and sets best to the
+//most visited move.  Called by think() for an MCTS player.
+int mctsThink(Engine &engine, Position &pos, Move &best);
+
+//showThinking() is the computer player's poll hook in a game
+//against a person.  It keeps a clock and the progress of the
+//search up to date on one line of the screen and, when the
+//keyboard is a terminal (on POSIX systems), reads what the
+//player types while the computer thinks, without ever waiting
+//for it: "stop" or "now" makes the computer move at once, and
+//0 quits.  Anything else typed is left for the game to read
+//once the computer has moved.
+void showThinking(Engine &engine);
+
+//moveText() writes move the way a player would type it, row
+//then column, 1-based, with a dash between squares, as in
+//"32-41" or "36-54-72".
+string moveText(const Move &move);
+
+//readMove() reads text, written the way moveText() writes a
+//move, into move, and returns false if it is not a move.  Only
+//the squares are checked, not whether the move is legal.
+bool readMove(const char *text, Move &move);
+
+//findMove() returns the index of move among the moves
+//generateMoves() finds in pos, or -1 if it is not a legal move
+//there.
+int findMove(Position &pos, const Move &move);
+
+//checkMove() plays move in pos if a player could play it at the
+//prompt, checking it the way main() does: the piece must be
+//the mover's, as getMove() checks, the first step must pass
+//validMove(), and each further step must be a jump that
+//isDoubleJumpAvailable() puts in the jump registry, as
+//grantDoubleJump() checks.  It accepts exactly the moves
+//findMove() finds, without generating all the others.  Returns
+//false, leaving pos in an unknown state, if move is illegal.
+bool checkMove(Position &pos, const Move &move);
+
+//packMove() packs move into 16 bits for a GameHistory: the
+//playable square it starts from (numbered as in a Snapshot) in
+//bits 0-4, the one it ends on in bits 5-9, and how many pieces
+//it jumps in bits 10-13.  packedMoveText() writes a packed move
+//the way moveText() does, leaving out the squares in between
+//of a double jump, as in "36-...-72".
+unsigned short packMove(const Move &move);
+string packedMoveText(unsigned short packed);
+
+//recordMove() adds move to history, dropping the oldest move
+//if it is full.
+void recordMove(GameHistory &history, const Move &move);
+
+//saveSnapshot() packs pos, the computer's side and history
+//into snapshot.  loadSnapshot() unpacks one again, and returns
+//false, leaving its arguments in an unknown state, if snapshot
+//is not one that saveSnapshot() could have made.
+void saveSnapshot(const Position &pos, int computer, const GameHistory &history, Snapshot &snapshot);
+bool loadSnapshot(const Snapshot &snapshot, Position &pos, int &computer, GameHistory &history);
+
+//snapshotText() writes snapshot as 88 characters of base64, for
+//sending it where only text goes, and readSnapshotText() reads
+//it back, returning false if text is not a snapshot.
+string snapshotText(const Snapshot &snapshot);
+bool readSnapshotText(const char *text, Snapshot &snapshot);
+
+//writeSnapshotFile() and readSnapshotFile() save snapshot to
+//file and read it back, and return false if they cannot.
+bool writeSnapshotFile(const char *file, const Snapshot &snapshot);
+bool readSnapshotFile(const char *file, Snapshot &snapshot);
+
+//saveGame() saves the game in main() to file, if it is not
+//NULL, for --resume to carry on, and tells the player so.
+void saveGame(const char *file, int grid[][8], int turn, int computer, const GameHistory &history);
+
+//openJournal() starts a write-behind journal of games in file:
+//a record of every game's start, moves and end, from which the
+//games in progress can be recovered after a crash.  Records
+//are queued without locking and written out by a thread of
+//its own, which syncs them to disk a batch at a time, and
+//file is rotated once it grows past rotateBytes.  A torn
+//record left at the end by a crash is cut off first, and the
+//games the file leaves unfinished are reported, and kept in
+//the files it is rotated to.  Returns false
+//if file cannot be opened.  closeJournal() writes out what is
+//still queued and stops the thread; openJournal() registers
+//it with atexit().
+bool openJournal(const char *file, size_t rotateBytes);
+void closeJournal();
+
+//journalStart() journals the start of a game in pos, plies
+//moves in, with the computer playing player computer (or
+//nobody), and returns the game's number.  journalMove() and
+//journalEnd() journal a move in a game and its end, with
+//winner the winner, or 0 if the game was abandoned.  Without
+//a journal they do nothing, and journalStart() returns 0, a
+//number the others ignore.
+unsigned long long journalStart(const Position &pos, int computer, int plies);
+void journalMove(unsigned long long game, const Move &move);
+void journalEnd(unsigned long long game, int winner);
+
+//runRecovery() reads the journal in file, without changing it,
+//and writes a line to std::cout for each game it leaves
+//unfinished: the game's number, its position as positionText()
+//writes it, and a snapshot of it as snapshotText() writes it,
+//for --serve's resume command.  Returns false if file cannot
+//be read.
+bool runRecovery(const char *file);
+
+//runMatch() plays pairs of games between two computer players,
+//each opening once with each player moving first, on threads
+//threads, and reports the score, Elo difference and draw rate
+//as it goes.  It stops after maxPairs pairs or, if sprt is
+//true, as soon as a sequential probability ratio test decides
+//between the hypotheses that a is elo0 or elo1 Elo stronger
+//than b.
+void runMatch(const EngineConfig &a, const EngineConfig &b, int maxPairs, bool sprt, double elo0, double elo1, int threads);
+
+//runExport() has a computer player with config play games games
+//against itself, from random openings, on threads threads, and
+//writes the positions to std::cout as training data for the
+//evaluation network: one line per position, giving the
+//position as readPosition() reads it, the search's score and
+//the result of the game (1 for a win, 0 for a draw, -1 for a
+//loss), both for the side to move.
+void runExport(long long games, const EngineConfig &config, int threads);
+
+//runSolver() tries to prove the outcome of pos with proof-number
+//search: whether the side to move can force a win, whether the
+//other side can, or neither within maxPlies plies (a draw as far
+//as the solver can see).  It prints the result and the line that
+//proves it.  threads threads share one search tree, kept in a
+//table of nodes nodes.
+void runSolver(const Position &pos, int maxPlies, long long nodes, int threads);
+
+//runAnnotation() reads games from file, one to a line as moves
+//from the start written the way moveText() writes them, replays
+//them by the rules of the game, and has a computer player with
+//config analyse every position, on threads threads.  For each
+//game it writes a line of JSON to std::cout giving, for every
+//move, what the computer thought of it, the move it would have
+//played instead, how much was lost, and whether that makes the
+//move a mistake or a blunder.
+void runAnnotation(const char *file, const EngineConfig &config, int threads);
+
+//runServer() hosts up to maxSessions games at once for clients
+//connecting to address: a Unix domain socket path or, if it is
+//all digits, a TCP port on localhost.  One thread serves every
+//connection from an epoll loop; the computer player's moves are
+//worked out by threads threads with settings config.  It runs
+//until interrupted, then prints how it went.  The protocol is
+//described with handleCommand().  Linux only.
+#ifdef __linux__
+void runServer(const char *address, const EngineConfig &config, int threads, int maxSessions);
+#endif
+
+//replayGame() plays the game in line, written as for
+//runAnnotation() and optionally preceded by a position as
+//readPosition() reads it, into pos, from the start if there is
+//no position.  Each move is played by play, which is checkMove()
+//but for testing.  It returns the number of moves played, and
+//sets bad to the first move that could not be read or played, or
+//to NULL if there was none.  A malformed position returns -1.
+//line is written to while it is read, but left as it was.
+int replayGame(char *line, Position &pos, char *&bad, bool (*play)(Position &, const Move &));
+
+//runReplay() replays every game in file ("-" for std::cin),
+//one to a line, blank lines aside, and writes a line to
+//std::cout for each game with a move that cannot be read or is
+//illegal, naming the first such move.  Nothing else is written
+//but a summary to std::cerr.  Returns false if any game had
+//such a move.
+bool runReplay(const char *file);
+
+//runAnalysis() searches start with a computer player with
+//config, deepening one ply at a time as think() does, but
+//keeping the best count moves apart rather than just the best
+//one.  After each depth it writes a line of JSON to std::cout
+//for each of them, best first, giving its score and principal
+//variation.
+void runAnalysis(const Position &start, const EngineConfig &config, int count);
+
+//batchBytes() returns the size of the block allocateBatch()
+//needs for a batch of capacity games, and allocateBatch()
+//gives batch its arrays.
+size_t batchBytes(int capacity);
+void allocateBatch(GameBatch &batch, int capacity);
+
+//initBatch() sets batch up with size new games, each with its
+//own random number generator seeded from seed.  size must be
+//no more than the batch's capacity.
+void initBatch(GameBatch &batch, int size, unsigned long long seed);
+
+//batchGenerateMoves() finds the moves of every game in batch
+//that is still going.
+void batchGenerateMoves(GameBatch &batch);
+
+//batchChooseMoves() picks one of the generated moves at random
+//for every game that is still going, preferring jumps, and
+//ends the games in which the side to move cannot move.
+void batchChooseMoves(GameBatch &batch);
+
+//batchApplyMoves() plays the chosen move in every game.
+void batchApplyMoves(GameBatch &batch);
+
+//batchFinishGames() updates the piece counts of every game and
+//ends the ones that are won or have gone on too long.  Returns
+//the number of games still going.
+int batchFinishGames(GameBatch &batch);
+
+//runSimulation() plays games random games to the end in batches,
+//on threads threads, and reports how many games per second that
+//came to and how the games ended.
+void runSimulation(long long games, int threads);
+
+//runBenchmarks() times the game's core routines on a fixed
+//set of positions and writes one JSON object per routine
+//to std::cout.  Used by --bench.
+void runBenchmarks();
+
+//runSuite() has a computer player with config search each of
+//the benchmark positions afresh and writes one JSON object per
+//position to std::cout, giving the depth reached, the nodes
+//searched, the time taken, the score and the move chosen, then
+//one with the totals.  Used by --suite to compare settings.
+void runSuite(const EngineConfig &config);
+
+//writeTrace() writes every thread's recorded trace
+//events to traceFile as Chrome trace-event JSON.  Like
+//printStats(), it is registered with atexit(), so that it
+//runs once every worker thread has been joined, and does
+//nothing if tracing was not switched on.
+void writeTrace();
+
+
+//A fuzzing build has libFuzzer's main() instead of this one.
+#ifndef CHECKERS_FUZZ
+int main(int argc, char *argv[])
 {
   /* Variable description:
 
@@ -146,19 +1428,523 @@ int main()
   int grid[8][8];
   int jumpReg[4][2];
 
+  //Set by --bench, which runs the benchmarks instead
+  //of a game, and --suite, which runs the computer player
+  //set up by --engine on the benchmark positions.
+  bool bench = false, suite = false;
+
+  //Set by --match, which plays the computer player configured
+  //by matchA against the one configured by matchB.  --pairs,
+  //--sprt and --threads control the match.
+  const char *matchA = NULL, *matchB = NULL;
+  int matchPairs = 1000;
+  bool sprt = false;
+  double elo0 = 0, elo1 = 0;
+  int threads = thread::hardware_concurrency();
+
+  //Set by --solve, which runs the proof-number solver on
+  //the given position.  --solve-plies and --solve-nodes
+  //set how far it looks and how big its node table is.
+  const char *solvePosition = NULL;
+  int solvePlies = 40;
+  long long solveNodes = 4000000;
+
+  //--computer makes player 1 or 2 a computer player, with
+  //the settings given by --engine.
+  int computerPlayer = 0;
+  const char *engineSettings = "";
+
+  //Set by --simulate, which plays that many random games
+  //in batches instead of a game.
+  long long simulateGames = 0;
+
+  //Set by --annotate, which analyses the games in the given
+  //file with the computer player set up by --engine.
+  const char *annotateFile = NULL;
+
+  //Set by --replay, which checks the games in the given file
+  //instead of playing one.
+  const char *replayFile = NULL;
+
+  //Set by --serve, which hosts games for clients connecting
+  //to the given address instead of playing one.  --sessions
+  //is how many it hosts at most.
+  const char *serveAddress = NULL;
+#ifdef __linux__
+  int maxSessions = 10000;
+#endif
+
+  //--resume carries on the game saved in the given file, and
+  //--save names the file a game is saved to when a player
+  //quits (the --resume file, if it is not given).  history is
+  //the game's moves, for the snapshot.
+  const char *resumeFile = NULL, *saveFile = NULL;
+  GameHistory history = {};
+
+  //--network loads the evaluation network in the given file,
+  //for computer players set up with nn=1.  Set by
+  //--export-training, which plays that many games with the
+  //computer player set up by --engine and writes out their
+  //positions as training data for the network.
+  const char *networkFile = NULL;
+  long long exportGames = 0;
+
+  //Set by --analyse, which analyses the position the given
+  //game leads to with the computer player set up by --engine,
+  //showing the best analysisLines moves.
+  const char *analysisGame = NULL;
+  int analysisLines = 3;
+
+  //--journal journals the game played, or the games hosted by
+  //--serve, to the given file, which is rotated once it grows
+  //past --journal-size megabytes.  Set by --recover, which
+  //lists the games the given journal leaves unfinished.
+  //journalGame is the game's number in the journal.
+  const char *journalFile = NULL, *recoverFile = NULL;
+  size_t journalBytes = 64 << 20;
+  unsigned long long journalGame = 0;
+
+  if(threads < 1)
+    threads = 1;
+
+  //--stats-json names a file to receive the statistics
+  //report, and --trace a file to receive the trace.
+  //--memory-budget sets memoryBudget, in megabytes, and --pin
+  //and --huge-pages set threadPlacement and hugePages.
+  for(int i = 1; i < argc; i++)
+    {
+      if(strcmp(argv[i], "--bench") == 0)
+	bench = true;
+      else if(strcmp(argv[i], "--suite") == 0)
+	suite = true;
+      else if(strcmp(argv[i], "--match") == 0 && i + 2 < argc)
+	{
+	  matchA = argv[++i];
+	  matchB = argv[++i];
+	}
+      else if(strcmp(argv[i], "--pairs") == 0 && i + 1 < argc)
+	matchPairs = atoi(argv[++i]);
+      else if(strcmp(argv[i], "--sprt") == 0 && i + 2 < argc)
+	{
+	  sprt = true;
+	  elo0 = atof(argv[++i]);
+	  elo1 = atof(argv[++i]);
+	}
+      else if(strcmp(argv[i], "--solve") == 0 && i + 1 < argc)
+	solvePosition = argv[++i];
+      else if(strcmp(argv[i], "--solve-plies") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+	solvePlies = atoi(argv[++i]);
+      else if(strcmp(argv[i], "--solve-nodes") == 0 && i + 1 < argc && atoll(argv[i + 1]) >= 1000)
+	solveNodes = atoll(argv[++i]);
+      else if(strcmp(argv[i], "--computer") == 0 && i + 1 < argc && (strcmp(argv[i + 1], "1") == 0 || strcmp(argv[i + 1], "2") == 0))
+	computerPlayer = atoi(argv[++i]);
+      else if(strcmp(argv[i], "--engine") == 0 && i + 1 < argc)
+	engineSettings = argv[++i];
+      else if(strcmp(argv[i], "--simulate") == 0 && i + 1 < argc && atoll(argv[i + 1]) > 0)
+	simulateGames = atoll(argv[++i]);
+      else if(strcmp(argv[i], "--annotate") == 0 && i + 1 < argc)
+	annotateFile = argv[++i];
+      else if(strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+	replayFile = argv[++i];
+      else if(strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+	serveAddress = argv[++i];
+#ifdef __linux__
+      else if(strcmp(argv[i], "--sessions") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+	maxSessions = atoi(argv[++i]);
+#endif
+      else if(strcmp(argv[i], "--resume") == 0 && i + 1 < argc)
+	resumeFile = argv[++i];
+      else if(strcmp(argv[i], "--save") == 0 && i + 1 < argc)
+	saveFile = argv[++i];
+      else if(strcmp(argv[i], "--network") == 0 && i + 1 < argc)
+	networkFile = argv[++i];
+      else if(strcmp(argv[i], "--analyse") == 0 && i + 1 < argc)
+	analysisGame = argv[++i];
+      else if(strcmp(argv[i], "--lines") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+	analysisLines = atoi(argv[++i]);
+      else if(strcmp(argv[i], "--journal") == 0 && i + 1 < argc)
+	journalFile = argv[++i];
+      else if(strcmp(argv[i], "--journal-size") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+	journalBytes = (size_t) atoi(argv[++i]) << 20;
+      else if(strcmp(argv[i], "--recover") == 0 && i + 1 < argc)
+	recoverFile = argv[++i];
+      else if(strcmp(argv[i], "--export-training") == 0 && i + 1 < argc && atoll(argv[i + 1]) > 0)
+	exportGames = atoll(argv[++i]);
+      else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+	threads = atoi(argv[++i]);
+      else if(strcmp(argv[i], "--pin") == 0 && i + 1 < argc && (strcmp(argv[i + 1], "cores") == 0 || strcmp(argv[i + 1], "nodes") == 0))
+	threadPlacement = strcmp(argv[++i], "cores") == 0 ? PLACE_CORES : PLACE_NODES;
+      else if(strcmp(argv[i], "--huge-pages") == 0 && i + 1 < argc
+	      && (strcmp(argv[i + 1], "transparent") == 0 || strcmp(argv[i + 1], "explicit") == 0))
+	hugePages = strcmp(argv[++i], "transparent") == 0 ? HUGE_PAGES_TRANSPARENT : HUGE_PAGES_EXPLICIT;
+      else if(strcmp(argv[i], "--memory-budget") == 0 && i + 1 < argc && atoi(argv[i + 1]) >= 8)
+	memoryBudget = (size_t) atoi(argv[++i]) << 20;
+      else if(strcmp(argv[i], "--stats-json") == 0 && i + 1 < argc)
+	statsJsonFile = argv[++i];
+      else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+	traceFile = argv[++i];
+      else
+	{
+	  cerr << "Unknown option: " << argv[i] << endl;
+	  return 1;
+	}
+    }
+
+#ifndef __linux__
+  if(threadPlacement != PLACE_NONE || hugePages != HUGE_PAGES_NONE)
+    {
+      cerr << "--pin and --huge-pages are only available on Linux" << endl;
+      return 1;
+    }
+#endif
+
+  atexit(printStats);
+  atexit(writeTrace);
+
+  readTopology();
+
+  if(threadPlacement != PLACE_NONE || hugePages != HUGE_PAGES_NONE)
+    reportPlacement();
+
+  //The arena is set up before anything else, and each mode
+  //below then sizes its tables to fit what is left of it.
+  if(memoryBudget)
+    {
+      if(!initArena())
+	{
+	  cerr << "Could not allocate a memory budget of " << (memoryBudget >> 20) << " MB" << endl;
+	  return 1;
+	}
+
+      atexit(printMemoryReport);
+    }
+
+  initZobrist();
+
+  if(networkFile && !loadNetwork(networkFile))
+    {
+      cerr << "No evaluation network in " << networkFile << endl;
+      return 1;
+    }
+
+  if(bench)
+    {
+      runBenchmarks();
+      return 0;
+    }
+
+  if(suite)
+    {
+      EngineConfig config;
+
+      if(!readEngineConfig(engineSettings, config))
+	{
+	  cerr << "Bad engine settings for --engine" << endl;
+	  return 1;
+	}
+
+      if(memoryBudget && !fitEngine(config, arenaAvailable()))
+	{
+	  cerr << "The memory budget is too small for the computer player" << endl;
+	  return 1;
+	}
+
+      runSuite(config);
+      return 0;
+    }
+
+  if(matchA)
+    {
+      EngineConfig a, b;
+
+      if(!readEngineConfig(matchA, a) || !readEngineConfig(matchB, b))
+	{
+	  cerr << "Bad engine settings for --match" << endl;
+	  return 1;
+	}
+
+      //Every match thread has an engine of each kind.
+      size_t share = arenaAvailable() / (2 * threads);
+
+      if(memoryBudget && (!fitEngine(a, share) || !fitEngine(b, share)))
+	{
+	  cerr << "The memory budget is too small for " << threads << " match threads" << endl;
+	  return 1;
+	}
+
+      runMatch(a, b, matchPairs, sprt, elo0, elo1, threads);
+      return 0;
+    }
+
+  if(exportGames)
+    {
+      EngineConfig config;
+
+      if(!readEngineConfig(engineSettings, config) || config.mcts)
+	{
+	  cerr << "Bad engine settings for --engine" << endl;
+	  return 1;
+	}
+
+      if(memoryBudget && !fitEngine(config, arenaAvailable() / threads))
+	{
+	  cerr << "The memory budget is too small for " << threads << " export threads" << endl;
+	  return 1;
+	}
+
+      runExport(exportGames, config, threads);
+      return 0;
+    }
+
+  if(simulateGames)
+    {
+      runSimulation(simulateGames, threads);
+      return 0;
+    }
+
+  if(replayFile)
+    return runReplay(replayFile) ? 0 : 1;
+
+  if(recoverFile)
+    return runRecovery(recoverFile) ? 0 : 1;
+
+  if(serveAddress)
+    {
+      EngineConfig config;
+
+      if(!readEngineConfig(engineSettings, config))
+	{
+	  cerr << "Bad engine settings for --engine" << endl;
+	  return 1;
+	}
+
+#ifdef __linux__
+      if(journalFile && !openJournal(journalFile, journalBytes))
+	return 1;
+
+      runServer(serveAddress, config, threads, maxSessions);
+      return 0;
+#else
+      cerr << "--serve is only available on Linux" << endl;
+      return 1;
+#endif
+    }
+
+  if(annotateFile)
+    {
+      EngineConfig config;
+
+      if(!readEngineConfig(engineSettings, config))
+	{
+	  cerr << "Bad engine settings for --engine" << endl;
+	  return 1;
+	}
+
+      if(memoryBudget && !fitEngine(config, arenaAvailable() / threads))
+	{
+	  cerr << "The memory budget is too small for " << threads << " annotation threads" << endl;
+	  return 1;
+	}
+
+      runAnnotation(annotateFile, config, threads);
+      return 0;
+    }
+
+  if(analysisGame)
+    {
+      EngineConfig config;
+      Position pos;
+      string game = analysisGame;
+      char *bad;
+
+      if(!readEngineConfig(engineSettings, config) || config.mcts)
+	{
+	  cerr << "Bad engine settings for --engine" << endl;
+	  return 1;
+	}
+
+      if(memoryBudget && !fitEngine(config, arenaAvailable()))
+	{
+	  cerr << "The memory budget is too small for the computer player" << endl;
+	  return 1;
+	}
+
+      int played = replayGame(&game[0], pos, bad, checkMove);
+
+      if(bad)
+	{
+	  if(played < 0)
+	    cerr << "Bad position for --analyse: " << string(bad, strcspn(bad, " \t\r")) << endl;
+	  else
+	    cerr << "Move " << played + 1 << " for --analyse, " << string(bad, strcspn(bad, " \t\r")) << ", is illegal" << endl;
+	  return 1;
+	}
+
+      runAnalysis(pos, config, analysisLines);
+      return 0;
+    }
+
+  if(solvePosition)
+    {
+      Position pos;
+
+      if(!readPosition(solvePosition, pos.grid, pos.turn))
+	{
+	  cerr << "Bad position for --solve: " << solvePosition << endl;
+	  return 1;
+	}
+
+      countPieces(pos.grid, pos.p1Pieces, pos.p2Pieces);
+      runSolver(pos, solvePlies, solveNodes, threads);
+      return 0;
+    }
+
+  Engine computer;
+  EngineConfig computerConfig;
+  ThinkingDisplay display;
+  Position resumed;
+
+  if(!readEngineConfig(engineSettings, computerConfig))
+    {
+      cerr << "Bad engine settings for --engine" << endl;
+      return 1;
+    }
+
+  //A resumed game keeps its computer player unless --computer
+  //says otherwise.
+  if(resumeFile)
+    {
+      Snapshot snapshot;
+      int savedComputer;
+
+      if(!readSnapshotFile(resumeFile, snapshot) || !loadSnapshot(snapshot, resumed, savedComputer, history))
+	{
+	  cerr << "No saved game in " << resumeFile << endl;
+	  return 1;
+	}
+
+      if(!computerPlayer)
+	computerPlayer = savedComputer;
+      if(!saveFile)
+	saveFile = resumeFile;
+    }
+
+  if(computerPlayer)
+    {
+      if(memoryBudget && !fitEngine(computerConfig, arenaAvailable()))
+	{
+	  cerr << "The memory budget is too small for the computer player" << endl;
+	  return 1;
+	}
+
+      initEngine(computer, computerConfig);
+      computer.poll = showThinking;
+      computer.pollContext = &display;
+
+#if defined(__unix__) || defined(__APPLE__)
+      if(isatty(STDIN_FILENO))
+	cin.rdbuf(&terminalInput);
+#endif
+    }
+
   //Set up the grid array to have the initial
   //configuration of a checkerboard.
   arrangeGrid(grid);
 
+  if(resumeFile)
+    {
+      memcpy(grid, resumed.grid, sizeof(grid));
+      turn = resumed.turn;
+      p1Pieces = resumed.p1Pieces;
+      p2Pieces = resumed.p2Pieces;
+    }
+
+  if(journalFile)
+    {
+      Position pos;
+
+      if(!openJournal(journalFile, journalBytes))
+	return 1;
+
+      memcpy(pos.grid, grid, sizeof(grid));
+      pos.turn = turn;
+      pos.p1Pieces = p1Pieces;
+      pos.p2Pieces = p2Pieces;
+      journalGame = journalStart(pos, computerPlayer, history.plies);
+    }
+
   //The help/welcome text is the first thing printed
   //to std::cout when a user loads the program.
   printHelp();
 
+  if(resumeFile)
+    {
+      cout << "Resumed a game " << history.plies << " moves in.";
+
+      if(history.length > 0)
+	cout << "  Last move: " << packedMoveText(history.moves[history.length - 1]);
+
+      cout << endl;
+    }
+
   //This while loop will run as long as both
   //players still have at least one piece
   //remaining on the board.
   while(p1Pieces > 0 && p2Pieces > 0)
     {
+      TRACE_SCOPE("turn");
+
+      //If the computer is playing this side, it picks
+      //and makes the whole move itself, double jumps and
+      //all.
+      if(turn == computerPlayer)
+	{
+	  Position pos;
+	  Move move;
+
+	  memcpy(pos.grid, grid, sizeof(grid));
+	  pos.turn = turn;
+	  pos.p1Pieces = p1Pieces;
+	  pos.p2Pieces = p2Pieces;
+
+	  drawBoard(grid);
+	  cout << "Player " << turn << " (computer) is thinking.  Type stop to make it move now, or 0 to quit." << endl;
+
+	  display.drawn = -1;
+	  display.quit = false;
+	  think(computer, pos, move);
+	  cout << endl;
+
+	  if(display.quit)
+	    {
+	      saveGame(saveFile, grid, turn, computerPlayer, history);
+	      journalEnd(journalGame, 0);
+	      cout << "\nExiting program.  Have a nice day!\n";
+
+	      return 0;
+	    }
+
+	  //A player who cannot move has lost.
+	  if(move.length == 0)
+	    {
+	      cout << "\nPlayer " << turn << " has no moves left.  Congratulations, Player "
+		   << (turn == 1 ? 2 : 1) << "!  You win!" << endl;
+	      journalEnd(journalGame, turn == 1 ? 2 : 1);
+	      return 0;
+	    }
+
+	  makeMove(pos, move);
+	  recordMove(history, move);
+	  journalMove(journalGame, move);
+	  memcpy(grid, pos.grid, sizeof(grid));
+	  p1Pieces = pos.p1Pieces;
+	  p2Pieces = pos.p2Pieces;
+
+	  cls();
+	  cout << "Player " << turn << " (computer) played " << moveText(move) << endl;
+	  turn = pos.turn;
+	  continue;
+	}
 
       //If it is player 1's turn, do the following
       //if block.
@@ -170,6 +1956,7 @@ int main()
 	  //for available double jumps if the player
 	  //made an initial jump to begin with.
 	  bool jumped = false;
+	  Move played;
 
 	  //Draw the game board.
 	  drawBoard(grid);
@@ -187,6 +1974,8 @@ int main()
 	  //equal -1.
 	  if(xFrom == -1 && yFrom == -1 && xTo == -1 && yTo == -1)
 	    {
+	      saveGame(saveFile, grid, turn, computerPlayer, history);
+	      journalEnd(journalGame, 0);
 	      cout << "\nExiting program.  Have a nice day!\n";
 
 	      return 0;
@@ -228,17 +2017,40 @@ int main()
 
 	  grid[xFrom][yFrom] = 0;
 
+	  //The move is written down for the game's history as
+	  //it goes, each further jump adding a square.
+	  played.path[0][0] = xFrom;
+	  played.path[0][1] = yFrom;
+	  played.path[1][0] = xTo;
+	  played.path[1][1] = yTo;
+	  played.length = 2;
+
 	  //If a piece was jumped, we check to see if there
 	  //are any double jumps available to the player from the
 	  //new location.  If that is the case, we grant them the
 	  //opportunity to take advantage of that double jump.
+	  //grantDoubleJump() sets xTo and yTo to -1 if the
+	  //player declines it, and off the board if they enter
+	  //a square that is not on it, which ends the move.
 	  if(jumped)
 	    {
 	      while(isDoubleJumpAvailable(xTo, yTo, turn, grid, jumpReg))
-		grantDoubleJump(turn, xTo, yTo, grid, p2Pieces, jumpReg);
+		{
+		  grantDoubleJump(turn, xTo, yTo, grid, p2Pieces, jumpReg);
+
+		  if(xTo < 0 || xTo > 7 || yTo < 0 || yTo > 7)
+		    break;
+
+		  played.path[played.length][0] = xTo;
+		  played.path[played.length][1] = yTo;
+		  played.length++;
+		}
 
 	    }
 
+	  recordMove(history, played);
+	  journalMove(journalGame, played);
+
 	  //It is now player 2's turn.
 	  turn = 2;
 
@@ -253,6 +2065,7 @@ int main()
 	  //for player 2.
 
 	  bool jumped = false;
+	  Move played;
 
 	  drawBoard(grid);
 
@@ -261,6 +2074,8 @@ int main()
 
 	   if(xFrom == -1 && yFrom == -1 && xTo == -1 && yTo == -1)
 	    {
+	      saveGame(saveFile, grid, turn, computerPlayer, history);
+	      journalEnd(journalGame, 0);
 	      cout << "\nExiting program.  Have a nice day!\n";
 
 	      return 0;
@@ -284,12 +2099,30 @@ int main()
 
 	  grid[xFrom][yFrom] = 0;
 
+	  played.path[0][0] = xFrom;
+	  played.path[0][1] = yFrom;
+	  played.path[1][0] = xTo;
+	  played.path[1][1] = yTo;
+	  played.length = 2;
+
 	  if(jumped)
 	    {
 	      while(isDoubleJumpAvailable(xTo, yTo, turn, grid, jumpReg))
-		grantDoubleJump(turn, xTo, yTo, grid, p1Pieces, jumpReg);
+		{
+		  grantDoubleJump(turn, xTo, yTo, grid, p1Pieces, jumpReg);
+
+		  if(xTo < 0 || xTo > 7 || yTo < 0 || yTo > 7)
+		    break;
+
+		  played.path[played.length][0] = xTo;
+		  played.path[played.length][1] = yTo;
+		  played.length++;
+		}
 	    }
 
+	  recordMove(history, played);
+	  journalMove(journalGame, played);
+
 	  turn = 1;
 
 	  cls();
@@ -305,6 +2138,7 @@ int main()
   //then he is the winner.  Otherwise, it must be player 2.
 
   drawBoard(grid);
+  journalEnd(journalGame, p1Pieces > 0 ? 1 : 2);
 
   if(p1Pieces > 0)
     cout << "Congratulations, Player 1!  You win!" << endl;
@@ -313,6 +2147,7 @@ int main()
 
   return 0;
 }
+#endif
 
 void drawHeader()
 {
@@ -534,6 +2369,8 @@ void printHelp()
 
 bool getMove(int &xFrom, int &xTo, int &yFrom, int &yTo, int turn, int grid[][8])
 {
+  TRACE_SCOPE("input wait");
+
   //Requesting the x and y coordinates from the player whose
   //turn it is of the piece they wish to move.
   cout << "Player " << turn << ", enter piece to move: ";
@@ -668,7 +2505,7 @@ bool getMove(int &xFrom, int &xTo, int &yFrom, int &yTo, int turn, int grid[][8]
       return true;
     }
 
-  if(xTo < 0 || xTo > 8 || yTo < 0 || yFrom > 8)
+  if(xTo < 0 || xTo > 8 || yTo < 0 || yTo > 8)
     {
       cls();
       cerr << "Invalid input!" << endl;
@@ -688,6 +2525,8 @@ bool getMove(int &xFrom, int &xTo, int &yFrom, int &yTo, int turn, int grid[][8]
 
 bool validMove(int xFrom, int xTo, int yFrom, int yTo, int turn, int grid[][8], int &pieces)
 {
+  STAT_TIME(PHASE_VALIDMOVE);
+
   //"If the destination is not
   //empty, return false."
   if(grid[xTo][yTo] != 0)
@@ -757,12 +2596,14 @@ bool validMove(int xFrom, int xTo, int yFrom, int yTo, int turn, int grid[][8],
 	  //variable).
 	  pieces--;
 
+	  STAT_COUNT(COUNT_JUMPS_ACCEPTED);
 	  return true;
 	}
 
       //Returning true also in the case the
       //move was valid but nevertheless not
       //a jump.
+      STAT_COUNT(COUNT_MOVES_ACCEPTED);
       return true;
     }
 
@@ -774,6 +2615,11 @@ bool validMove(int xFrom, int xTo, int yFrom, int yTo, int turn, int grid[][8],
 	  if(grid[xFrom][yFrom] == 1)
 	    return false;
 
+	  //"If they have not moved up by one or two rows,
+	  //return false."
+	  if(xTo != xFrom - 1 && xTo != xFrom - 2)
+	    return false;
+
 	  //"If they have moved more than two columns, or tried to
 	  //move in the same column, return false."
 	  if(yTo == yFrom || yTo > yFrom + 2 || yTo < yFrom - 2)
@@ -828,10 +2674,12 @@ bool validMove(int xFrom, int xTo, int yFrom, int yTo, int turn, int grid[][8],
 	      //return true.
 	      pieces--;
 
+	      STAT_COUNT(COUNT_JUMPS_ACCEPTED);
 	      return true;
 	    }
 	  //Again, returning true in the event of
 	  //a non-jump move.
+	  STAT_COUNT(COUNT_MOVES_ACCEPTED);
 	  return true;
 	}
 
@@ -854,6 +2702,8 @@ void cls()
 
 bool isDoubleJumpAvailable(int x, int y, int turn, int grid[][8], int jumpReg[][2])
 {
+  STAT_TIME(PHASE_DOUBLEJUMP);
+
   int pieceType = grid[x][y];
   bool retVal = false;
 
@@ -862,7 +2712,10 @@ bool isDoubleJumpAvailable(int x, int y, int turn, int grid[][8], int jumpReg[][
   //the board.   It reads:  "If they are at the second-to-last x row at
   //either end, and there are no jumps available in a direction AWAY
   //from the x end of the board, there are no jumps to grant."
-  if(x == 1 && !((grid[x+1][y+1] != 0 && grid[x+2][y+2] == 0) || (grid[x+1][y-1] != 0 && grid[x+2][y-2] == 0)) || x == 7 && !((grid[x-1][y-1] != 0 && grid[x-2][y-2] == 0) || (grid[x-1][y+1] != 0 && grid[x-2][y+2] == 0)))
+  //A jump off the side of the board is not available either,
+  //and is not looked at, since that would read outside grid.
+  if((x == 1 && !((y < 6 && grid[x+1][y+1] != 0 && grid[x+2][y+2] == 0) || (y > 1 && grid[x+1][y-1] != 0 && grid[x+2][y-2] == 0)))
+     || (x == 7 && !((y > 1 && grid[x-1][y-1] != 0 && grid[x-2][y-2] == 0) || (y < 6 && grid[x-1][y+1] != 0 && grid[x-2][y+2] == 0))))
     return false;
 
   //Initialize the jump registry to -1 (because
@@ -1012,6 +2865,10 @@ bool isDoubleJumpAvailable(int x, int y, int turn, int grid[][8], int jumpReg[][
 	    }
 	}
     }
+
+  if(retVal)
+    STAT_COUNT(COUNT_DOUBLEJUMPS_FOUND);
+
   return retVal;
 }
 
@@ -1029,6 +2886,8 @@ void grantDoubleJump(int player, int &x, int &y, int grid[][8], int &pieces, int
   cls();
   drawBoard(grid);
 
+  TRACE_SCOPE("input wait");
+
   do
     {
       cout << endl << "Player " << player << ", you have a double jump"
@@ -1159,6 +3018,9 @@ void grantDoubleJump(int player, int &x, int &y, int grid[][8], int &pieces, int
 
 void drawBoard(int grid[][8])
 {
+  STAT_TIME(PHASE_RENDER);
+  TRACE_SCOPE("render");
+
   //Draw the top row of column numbers
   //and the upper borderline of the board.
   drawHeader();
@@ -1170,3 +3032,6890 @@ void drawBoard(int grid[][8])
 
 
 }
+
+void printStats()
+{
+#ifdef CHECKERS_STATS
+  //Every thread's counts, added up.
+  unsigned long long calls[NUM_PHASES] = { 0 };
+  unsigned long long nanos[NUM_PHASES] = { 0 };
+  unsigned long long counters[NUM_COUNTERS] = { 0 };
+  lock_guard<mutex> lock(statTablesLock);
+
+  for(size_t t = 0; t <= statTables.size(); t++)
+    {
+      StatTable &table = t < statTables.size() ? *statTables[t] : statFinished;
+
+      for(int i = 0; i < NUM_PHASES; i++)
+	{
+	  calls[i] += table.calls[i];
+	  nanos[i] += table.nanos[i];
+	}
+      for(int i = 0; i < NUM_COUNTERS; i++)
+	counters[i] += table.counters[i];
+    }
+
+  //Text table, one row per timed phase followed
+  //by the plain counters.
+  cerr << "\n" << left;
+  cerr.width(24);
+  cerr << "phase";
+  cerr.width(14);
+  cerr << "calls";
+  cerr.width(14);
+  cerr << "total ms";
+  cerr << "ns/call" << endl;
+
+  for(int i = 0; i < 60; i++)
+    cerr << '-';
+  cerr << endl;
+
+  for(int i = 0; i < NUM_PHASES; i++)
+    {
+      cerr.width(24);
+      cerr << statPhaseNames[i];
+      cerr.width(14);
+      cerr << calls[i];
+      cerr.width(14);
+      cerr << nanos[i] / 1000000.0;
+      cerr << (calls[i] ? nanos[i] / calls[i] : 0) << endl;
+    }
+
+  cerr << endl;
+
+  for(int i = 0; i < NUM_COUNTERS; i++)
+    {
+      cerr.width(24);
+      cerr << statCounterNames[i];
+      cerr << counters[i] << endl;
+    }
+
+  //Figures worked out from the counters above, which only
+  //mean something if the computer player has searched.
+  double nodes = counters[COUNT_NODES];
+  double searchSeconds = nanos[PHASE_SEARCH] / 1e9;
+  double nps = searchSeconds > 0 ? nodes / searchSeconds : 0;
+  double branching = calls[PHASE_MOVEGEN] ? double(counters[COUNT_MOVES_GENERATED]) / calls[PHASE_MOVEGEN] : 0;
+  double ttHitRate = counters[COUNT_TT_PROBES] ? double(counters[COUNT_TT_HITS]) / counters[COUNT_TT_PROBES] : 0;
+  double cutoffRate = counters[COUNT_NODES] ? double(counters[COUNT_BETA_CUTOFFS]) / counters[COUNT_NODES] : 0;
+  double firstMoveRate = counters[COUNT_BETA_CUTOFFS] ? double(counters[COUNT_FIRST_MOVE_CUTOFFS]) / counters[COUNT_BETA_CUTOFFS] : 0;
+  double playoutsPerSecond = searchSeconds > 0 ? counters[COUNT_PLAYOUTS] / searchSeconds : 0;
+
+  //What the evaluation cache saved: the evaluations its hits
+  //spared, at what the misses cost each, less the time spent
+  //keeping hashes up to date and looking them up.
+  double evalCacheHitRate = counters[COUNT_EVAL_CACHE_PROBES] ? double(counters[COUNT_EVAL_CACHE_HITS]) / counters[COUNT_EVAL_CACHE_PROBES] : 0;
+  double evaluateNanos = calls[PHASE_EVALUATE] ? double(nanos[PHASE_EVALUATE]) / calls[PHASE_EVALUATE] : 0;
+  double evalCacheSavedMs = (counters[COUNT_EVAL_CACHE_HITS] * evaluateNanos - nanos[PHASE_EVAL_CACHE]) / 1e6;
+
+  if(counters[COUNT_PLAYOUTS] > 0)
+    {
+      cerr << endl;
+      cerr.width(24);
+      cerr << "playouts/second" << playoutsPerSecond << endl;
+    }
+
+  if(nodes > 0)
+    {
+      cerr << endl;
+      cerr.width(24);
+      cerr << "nodes/second" << nps << endl;
+      cerr.width(24);
+      cerr << "branching factor" << branching << endl;
+      cerr.width(24);
+      cerr << "tt hit rate" << ttHitRate << endl;
+      cerr.width(24);
+      cerr << "cutoff rate" << cutoffRate << endl;
+      cerr.width(24);
+      cerr << "first move cutoffs" << firstMoveRate << endl;
+    }
+
+  if(counters[COUNT_EVAL_CACHE_PROBES] > 0)
+    {
+      cerr << endl;
+      cerr.width(24);
+      cerr << "eval cache hit rate" << evalCacheHitRate << endl;
+      cerr.width(24);
+      cerr << "eval cache ms saved" << evalCacheSavedMs << endl;
+    }
+
+  //The same numbers again as a single JSON object,
+  //for tools rather than people.
+  if(statsJsonFile)
+    {
+      ofstream out(statsJsonFile);
+
+      if(!out)
+	{
+	  cerr << "Could not write " << statsJsonFile << endl;
+	  return;
+	}
+
+      out << "{\"phases\":{";
+      for(int i = 0; i < NUM_PHASES; i++)
+	{
+	  if(i > 0)
+	    out << ',';
+	  out << '"' << statPhaseNames[i] << "\":{\"calls\":" << calls[i]
+	      << ",\"ns\":" << nanos[i] << '}';
+	}
+
+      out << "},\"counters\":{";
+      for(int i = 0; i < NUM_COUNTERS; i++)
+	{
+	  if(i > 0)
+	    out << ',';
+	  out << '"' << statCounterNames[i] << "\":" << counters[i];
+	}
+      out << "},\"derived\":{\"nps\":" << nps << ",\"branching_factor\":" << branching
+	  << ",\"tt_hit_rate\":" << ttHitRate << ",\"cutoff_rate\":" << cutoffRate
+	  << ",\"first_move_cutoff_rate\":" << firstMoveRate
+	  << ",\"playouts_per_second\":" << playoutsPerSecond << ",\"eval_cache_hit_rate\":" << evalCacheHitRate
+	  << ",\"eval_cache_ms_saved\":" << evalCacheSavedMs << "}}" << endl;
+    }
+#endif
+}
+
+void writeTrace()
+{
+  if(!traceFile)
+    return;
+
+  ofstream out(traceFile);
+
+  if(!out)
+    {
+      cerr << "Could not write " << traceFile << endl;
+      return;
+    }
+
+  lock_guard<mutex> lock(traceBuffersLock);
+  bool first = true;
+
+  out << "{\"traceEvents\":[";
+
+  for(size_t i = 0; i < traceBuffers.size(); i++)
+    {
+      TraceBuffer *buffer = traceBuffers[i];
+
+      //A buffer still in use belongs to a thread that was
+      //never joined, and cannot be read while it writes.
+      if(buffer->inUse)
+	continue;
+
+      //If the ring has wrapped, start at the oldest
+      //surviving event rather than at index 0.
+      unsigned long long begin = 0;
+      if(buffer->count > (unsigned long long) TRACE_BUFFER_SIZE)
+	begin = buffer->count - TRACE_BUFFER_SIZE;
+
+      for(unsigned long long k = begin; k < buffer->count; k++)
+	{
+	  TraceEvent &event = buffer->events[k % TRACE_BUFFER_SIZE];
+
+	  if(!first)
+	    out << ",\n";
+	  first = false;
+
+	  out << "{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+	      << buffer->thread << ",\"ts\":" << event.start << ",\"dur\":" << event.duration << '}';
+	}
+    }
+
+  out << "]}" << endl;
+}
+
+bool initArena()
+{
+  arenaSize = memoryBudget - memoryBudget / MEMORY_RESERVE_FRACTION;
+  arenaSize = arenaSize / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+  arenaUsed = 0;
+
+  if(hugePages != HUGE_PAGES_NONE || threadPlacement != PLACE_NONE)
+    arena = (char *) mapMemory(arenaSize, "the arena");
+  else
+    arena = (char *) aligned_alloc(BLOCK_ALIGNMENT, arenaSize);
+
+  if(!arena)
+    return false;
+
+  //Writing every byte makes the kernel back every page now,
+  //rather than one page at a time in the middle of a search.
+  //Mapped memory is already zeroed.
+  if(threadPlacement == PLACE_NONE)
+    memset(arena, 0, arenaSize);
+
+  return true;
+}
+
+void *allocateBlock(size_t bytes, const char *purpose)
+{
+  void *block = NULL;
+
+  bytes = (bytes + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+
+  {
+    lock_guard<mutex> guard(arenaLock);
+
+    if(!memoryBudget && hugePages != HUGE_PAGES_NONE && bytes >= HUGE_PAGE_SIZE)
+      block = mapMemory(bytes, purpose);
+    else if(!memoryBudget)
+      block = calloc(bytes, 1);
+    else if(bytes <= arenaSize - arenaUsed)
+      {
+	block = arena + arenaUsed;
+	arenaUsed += bytes;
+      }
+
+    if(block)
+      {
+	int use = 0;
+
+	while(use < memoryUseCount && memoryUses[use].purpose != purpose)
+	  use++;
+
+	if(use == memoryUseCount && memoryUseCount < MAX_MEMORY_USES)
+	  {
+	    memoryUses[use].purpose = purpose;
+	    memoryUses[use].bytes = 0;
+	    memoryUses[use].blocks = 0;
+	    memoryUseCount++;
+	  }
+
+	if(use < memoryUseCount)
+	  {
+	    memoryUses[use].bytes += bytes;
+	    memoryUses[use].blocks++;
+	  }
+      }
+  }
+
+  if(!block)
+    {
+      cerr << "Out of memory allocating " << bytes << " bytes for " << purpose << endl;
+      exit(1);
+    }
+
+  return block;
+}
+
+size_t arenaAvailable()
+{
+  lock_guard<mutex> guard(arenaLock);
+
+  return arenaSize - arenaUsed;
+}
+
+void printMemoryReport()
+{
+  lock_guard<mutex> guard(arenaLock);
+  ios::fmtflags flags = cerr.flags();
+  streamsize precision = cerr.precision(1);
+
+  cerr << "\n" << left << fixed;
+  cerr.width(24);
+  cerr << "memory budget" << memoryBudget / 1048576.0 << " MB" << endl;
+
+  for(int i = 0; i < memoryUseCount; i++)
+    {
+      cerr << "  ";
+      cerr.width(22);
+      cerr << memoryUses[i].purpose << memoryUses[i].bytes / 1048576.0 << " MB in "
+	   << memoryUses[i].blocks << (memoryUses[i].blocks == 1 ? " block" : " blocks") << endl;
+    }
+
+  cerr << "  ";
+  cerr.width(22);
+  cerr << "unused" << (arenaSize - arenaUsed) / 1048576.0 << " MB" << endl;
+  cerr << "  ";
+  cerr.width(22);
+  cerr << "reserve" << (memoryBudget - arenaSize) / 1048576.0 << " MB" << endl;
+
+  cerr.flags(flags);
+  cerr.precision(precision);
+}
+
+void *mapMemory(size_t bytes, const char *purpose)
+{
+#ifdef __linux__
+  if(hugePages == HUGE_PAGES_EXPLICIT)
+    {
+      size_t rounded = (bytes + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+      void *block = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+
+      if(block != MAP_FAILED)
+	return block;
+
+      cerr << "No explicit huge pages for " << rounded / 1048576.0 << " MB of " << purpose
+	   << "; using transparent huge pages instead" << endl;
+    }
+
+  //Map a huge page more than asked for and trim the ends, so
+  //that the block starts on a huge page boundary and the kernel
+  //can back all of it with transparent huge pages.
+  size_t mapped = bytes + HUGE_PAGE_SIZE;
+  char *start = (char *) mmap(NULL, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if(start == MAP_FAILED)
+    return NULL;
+
+  char *block = (char *) (((uintptr_t) start + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE);
+  size_t pageSize = sysconf(_SC_PAGESIZE);
+  char *end = (char *) (((uintptr_t) block + bytes + pageSize - 1) / pageSize * pageSize);
+
+  if(block > start)
+    munmap(start, block - start);
+  if(start + mapped > end)
+    munmap(end, start + mapped - end);
+
+  if(hugePages != HUGE_PAGES_NONE)
+    madvise(block, bytes, MADV_HUGEPAGE);
+
+  return block;
+#else
+  //Without huge pages or placement to ask for, a mapping is
+  //just zeroed memory.
+  void *block = aligned_alloc(BLOCK_ALIGNMENT, (bytes + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT);
+
+  if(block)
+    memset(block, 0, bytes);
+
+  return block;
+#endif
+}
+
+//readCpuList() reads a list of processors in the kernel's
+//format, such as "0-3,8-11", from file into cpus.
+void readCpuList(const string &file, vector<int> &cpus)
+{
+  ifstream in(file);
+  string text;
+
+  getline(in, text);
+
+  for(const char *p = text.c_str(); *p != '\0';)
+    {
+      char *end;
+      long first = strtol(p, &end, 10), last = first;
+
+      if(end == p)
+	break;
+
+      if(*end == '-')
+	last = strtol(end + 1, &end, 10);
+
+      for(long cpu = first; cpu <= last; cpu++)
+	cpus.push_back(cpu);
+
+      p = *end == ',' ? end + 1 : end;
+    }
+}
+
+void readTopology()
+{
+#ifndef __linux__
+  //Elsewhere threads are never placed, so all that matters is
+  //how many processors there are.
+  nodeCpus.assign(1, vector<int>());
+  cpuOrder.clear();
+
+  for(unsigned int cpu = 0; cpu < max(thread::hardware_concurrency(), 1u); cpu++)
+    {
+      nodeCpus[0].push_back(cpu);
+      cpuOrder.push_back(cpu);
+    }
+#else
+  cpu_set_t allowed;
+  DIR *nodes = opendir("/sys/devices/system/node");
+
+  CPU_ZERO(&allowed);
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+  nodeCpus.clear();
+
+  //Nodes are numbered, but not always without gaps.
+  for(dirent *entry = nodes ? readdir(nodes) : NULL; entry; entry = readdir(nodes))
+    {
+      vector<int> cpus, usable;
+
+      if(strncmp(entry->d_name, "node", 4) != 0 || !isdigit(entry->d_name[4]))
+	continue;
+
+      readCpuList(string("/sys/devices/system/node/") + entry->d_name + "/cpulist", cpus);
+
+      for(size_t i = 0; i < cpus.size(); i++)
+	if(cpus[i] < CPU_SETSIZE && CPU_ISSET(cpus[i], &allowed))
+	  usable.push_back(cpus[i]);
+
+      if(!usable.empty())
+	nodeCpus.push_back(usable);
+    }
+
+  if(nodes)
+    closedir(nodes);
+
+  //Without NUMA support in the kernel, every processor is on
+  //one node.
+  if(nodeCpus.empty())
+    {
+      nodeCpus.push_back(vector<int>());
+
+      for(int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	if(CPU_ISSET(cpu, &allowed))
+	  nodeCpus[0].push_back(cpu);
+    }
+
+  //Take the nodes in turn, and the processors of each node in
+  //turn, so that even a few threads spread over every node.
+  cpuOrder.clear();
+
+  for(size_t round = 0; cpuOrder.size() < (size_t) CPU_COUNT(&allowed); round++)
+    {
+      size_t before = cpuOrder.size();
+
+      for(size_t n = 0; n < nodeCpus.size(); n++)
+	if(round < nodeCpus[n].size())
+	  cpuOrder.push_back(nodeCpus[n][round]);
+
+      if(cpuOrder.size() == before)
+	break;
+    }
+#endif
+}
+
+void placeThread(int index)
+{
+  if(threadPlacement == PLACE_NONE)
+    return;
+
+#ifdef __linux__
+  cpu_set_t cpus;
+
+  CPU_ZERO(&cpus);
+
+  if(threadPlacement == PLACE_NODES)
+    {
+      const vector<int> &node = nodeCpus[index % nodeCpus.size()];
+
+      for(size_t i = 0; i < node.size(); i++)
+	CPU_SET(node[i], &cpus);
+    }
+  else
+    CPU_SET(cpuOrder[index % cpuOrder.size()], &cpus);
+
+  int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+  if(error != 0)
+    cerr << "Could not pin thread " << index << ": " << strerror(error) << endl;
+#endif
+}
+
+void reportPlacement()
+{
+  size_t cpus = 0;
+
+  for(size_t n = 0; n < nodeCpus.size(); n++)
+    cpus += nodeCpus[n].size();
+
+  if(threadPlacement != PLACE_NONE)
+    cerr << "Worker threads pinned " << (threadPlacement == PLACE_CORES ? "one to a processor" : "one to a node")
+	 << ", over " << cpus << (cpus == 1 ? " processor" : " processors") << " on " << nodeCpus.size()
+	 << (nodeCpus.size() == 1 ? " NUMA node" : " NUMA nodes") << "; tables are placed on their threads' nodes" << endl;
+
+  if(hugePages == HUGE_PAGES_NONE)
+    return;
+
+  //The kernel's setting is shown as, for example, "always
+  //[madvise] never", with the one in force in brackets.
+  ifstream in("/sys/kernel/mm/transparent_hugepage/enabled");
+  string setting;
+
+  getline(in, setting);
+
+  size_t open = setting.find('['), close = setting.find(']');
+
+  setting = open != string::npos && close > open ? setting.substr(open + 1, close - open - 1) : "unavailable";
+
+  if(hugePages == HUGE_PAGES_EXPLICIT)
+    cerr << "Tables of " << (HUGE_PAGE_SIZE >> 20) << " MB or more on explicit huge pages where there are any";
+  else
+    cerr << "Tables of " << (HUGE_PAGE_SIZE >> 20) << " MB or more on transparent huge pages";
+
+  cerr << " (transparent huge pages: " << setting << ")" << endl;
+
+  if(hugePages == HUGE_PAGES_TRANSPARENT && setting != "always" && setting != "madvise")
+    cerr << "Transparent huge pages are off; tables will use normal pages" << endl;
+}
+
+bool readPosition(const char *text, int grid[][8], int &turn)
+{
+  int newGrid[8][8];
+  int newTurn = 1;
+  int square = 0;
+
+  for(int i = 0; i < 8; i++)
+    for(int k = 0; k < 8; k++)
+      newGrid[i][k] = 0;
+
+  //Walk the playable squares in the same order as they
+  //are written: row by row, and in each row only the
+  //squares where row + column is odd (those are the
+  //squares arrangeGrid() uses).
+  for(; square < 32; square++)
+    {
+      int row = square / 4;
+      int col = (square % 4) * 2 + (row % 2 == 0 ? 1 : 0);
+
+      switch(text[square])
+	{
+	case '.': newGrid[row][col] = 0; break;
+	case 'x': newGrid[row][col] = 1; break;
+	case 'o': newGrid[row][col] = 2; break;
+	case 'X': newGrid[row][col] = 3; break;
+	case 'O': newGrid[row][col] = 4; break;
+	default: return false;
+	}
+    }
+
+  if(text[32] == ':')
+    {
+      if(text[33] == '1' || text[33] == '2')
+	newTurn = text[33] - '0';
+      else
+	return false;
+
+      if(text[34] != '\0')
+	return false;
+    }
+  else if(text[32] != '\0')
+    return false;
+
+  for(int i = 0; i < 8; i++)
+    for(int k = 0; k < 8; k++)
+      grid[i][k] = newGrid[i][k];
+
+  turn = newTurn;
+  return true;
+}
+
+string positionText(int grid[][8], int turn)
+{
+  static const char pieceChars[5] = { '.', 'x', 'o', 'X', 'O' };
+  string text;
+
+  for(int square = 0; square < 32; square++)
+    {
+      int row = square / 4;
+      int col = (square % 4) * 2 + (row % 2 == 0 ? 1 : 0);
+
+      text += pieceChars[grid[row][col]];
+    }
+
+  text += ':';
+  text += char('0' + turn);
+  return text;
+}
+
+void countPieces(int grid[][8], int &p1Pieces, int &p2Pieces)
+{
+  p1Pieces = 0;
+  p2Pieces = 0;
+
+  for(int i = 0; i < 8; i++)
+    for(int k = 0; k < 8; k++)
+      {
+	if(grid[i][k] == 1 || grid[i][k] == 3)
+	  p1Pieces++;
+	else if(grid[i][k] == 2 || grid[i][k] == 4)
+	  p2Pieces++;
+      }
+}
+
+//The positions every benchmark runs over: the opening,
+//and a handful of middle and end games with Kings and
+//jumps (single and double) available.
+const char *benchPositionText[] =
+  {
+    "xxxxxxxxxxxx........oooooooooooo:1",
+    "xxxxxxxx.x.x.xx..o..o.o.oooooooo:2",
+    "x.xxx.x.xx..o.x..x.o.oo.o.oooo.o:1",
+    "xx.x..xx.xo.x..o.ox.o..oo..o.o.o:2",
+    "..x.X...x.o..x....o.O..x...o....:2",
+    "X.......x.o.o...o.x.....O..o..x.:1",
+    ".x..xo...o..Xo...o.........O....:1",
+    "..........X.......o.........O...:2"
+  };
+
+const int NUM_BENCH_POSITIONS = sizeof(benchPositionText) / sizeof(benchPositionText[0]);
+
+int benchGrids[NUM_BENCH_POSITIONS][8][8];
+int benchTurns[NUM_BENCH_POSITIONS];
+
+//The same positions as the computer player sees them, as
+//Bitboards, and every move in each of them.
+Position benchPositions[NUM_BENCH_POSITIONS];
+Bitboard benchBitboards[NUM_BENCH_POSITIONS];
+Snapshot benchSnapshots[NUM_BENCH_POSITIONS];
+Move benchMoves[NUM_BENCH_POSITIONS][MAX_MOVES];
+int benchMoveCounts[NUM_BENCH_POSITIONS];
+EngineConfig benchConfig;
+
+//The position each of the moves leads to, and each position's
+//first network layer.
+Position benchChildren[NUM_BENCH_POSITIONS][MAX_MOVES];
+Accumulator benchAccumulators[NUM_BENCH_POSITIONS];
+Accumulator benchChildAccumulator;
+
+//Results are folded into this so that the compiler
+//cannot throw away the work being timed.
+volatile long long benchSink;
+
+//A stream buffer that discards everything, so that
+//drawBoard() can be timed without a terminal.
+struct NullBuffer : public streambuf
+{
+  int overflow(int c) { return c; }
+  streamsize xsputn(const char *, streamsize n) { return n; }
+};
+
+//Each benchmark body runs its routine once over the whole
+//position set and returns how many calls that was.
+
+long long benchArrangeGrid()
+{
+  int grid[8][8];
+
+  arrangeGrid(grid);
+  benchSink = benchSink + grid[0][1];
+  return 1;
+}
+
+long long benchBoardCopy()
+{
+  int grid[8][8];
+  long long calls = 0;
+
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    {
+      memcpy(grid, benchGrids[p], sizeof(grid));
+      benchSink = benchSink + grid[p % 8][0];
+      calls++;
+    }
+
+  return calls;
+}
+
+//Tries every diagonal step and jump of every piece of the
+//side to move, as a player could type it in.  validMove()
+//removes jumped pieces, so each call gets its own copy of
+//the board; benchBoardCopy gives the cost of that copy.
+long long benchValidMove()
+{
+  static const int steps[8][2] = { {1, 1}, {1, -1}, {-1, 1}, {-1, -1}, {2, 2}, {2, -2}, {-2, 2}, {-2, -2} };
+  int grid[8][8];
+  long long calls = 0;
+
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    {
+      int turn = benchTurns[p];
+
+      for(int x = 0; x < 8; x++)
+	for(int y = 0; y < 8; y++)
+	  {
+	    if(benchGrids[p][x][y] != turn && benchGrids[p][x][y] != turn + 2)
+	      continue;
+
+	    for(int d = 0; d < 8; d++)
+	      {
+		int xTo = x + steps[d][0], yTo = y + steps[d][1];
+		int pieces = 12;
+
+		if(xTo < 0 || xTo > 7 || yTo < 0 || yTo > 7)
+		  continue;
+
+		memcpy(grid, benchGrids[p], sizeof(grid));
+		benchSink = benchSink + validMove(x, xTo, y, yTo, turn, grid, pieces);
+		calls++;
+	      }
+	  }
+    }
+
+  return calls;
+}
+
+//Asks isDoubleJumpAvailable() about every piece of the
+//side to move.
+long long benchDoubleJump()
+{
+  int jumpReg[4][2];
+  long long calls = 0;
+
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    for(int x = 0; x < 8; x++)
+      for(int y = 0; y < 8; y++)
+	{
+	  int turn = benchTurns[p];
+
+	  if(benchGrids[p][x][y] != turn && benchGrids[p][x][y] != turn + 2)
+	    continue;
+
+	  benchSink = benchSink + isDoubleJumpAvailable(x, y, turn, benchGrids[p], jumpReg);
+	  calls++;
+	}
+
+  return calls;
+}
+
+long long benchDrawBoard()
+{
+  NullBuffer nullBuffer;
+  streambuf *old = cout.rdbuf(&nullBuffer);
+
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    drawBoard(benchGrids[p]);
+
+  cout.rdbuf(old);
+  return NUM_BENCH_POSITIONS;
+}
+
+long long benchGenerateMoves()
+{
+  Move moves[MAX_MOVES];
+
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    benchSink = benchSink + generateMoves(benchPositions[p], moves, false);
+
+  return NUM_BENCH_POSITIONS;
+}
+
+//The computer player copies a position and plays a move on
+//the copy, so making a move and taking it back costs one
+//copy and one makeMove().
+long long benchMakeMove()
+{
+  long long calls = 0;
+
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    for(int i = 0; i < benchMoveCounts[p]; i++)
+      {
+	Position child = benchPositions[p];
+	makeMove(child, benchMoves[p][i]);
+	benchSink = benchSink + child.turn;
+	calls++;
+      }
+
+  return calls;
+}
+
+long long benchHashPosition()
+{
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    benchSink = benchSink + hashPosition(benchPositions[p]);
+
+  return NUM_BENCH_POSITIONS;
+}
+
+long long benchHashChange()
+{
+  long long calls = 0;
+
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    for(int i = 0; i < benchMoveCounts[p]; i++)
+      {
+	benchSink = benchSink + hashChange(benchPositions[p], benchChildren[p][i], benchMoves[p][i]);
+	calls++;
+      }
+
+  return calls;
+}
+
+long long benchCanonicalHash()
+{
+  bool flipped;
+
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    benchSink = benchSink + canonicalHash(benchPositions[p], flipped);
+
+  return NUM_BENCH_POSITIONS;
+}
+
+long long benchCanonicalize()
+{
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    {
+      Bitboard board = benchBitboards[p];
+
+      //Flip player 1's positions too, so that every call
+      //does the work.
+      if(!canonicalize(board))
+	flipBitboard(board);
+
+      benchSink = benchSink + (board.pieces[0] ^ board.kings);
+    }
+
+  return NUM_BENCH_POSITIONS;
+}
+
+//Every position is saved with a full history, as a server
+//checkpointing a long game would.
+long long benchSaveSnapshot()
+{
+  GameHistory history;
+
+  history.plies = 60;
+  history.length = SNAPSHOT_HISTORY;
+
+  for(int i = 0; i < SNAPSHOT_HISTORY; i++)
+    history.moves[i] = i;
+
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    {
+      saveSnapshot(benchPositions[p], 2, history, benchSnapshots[p]);
+      benchSink = benchSink + benchSnapshots[p].kings;
+    }
+
+  return NUM_BENCH_POSITIONS;
+}
+
+long long benchLoadSnapshot()
+{
+  Position pos;
+  GameHistory history;
+  int computer;
+
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    benchSink = benchSink + loadSnapshot(benchSnapshots[p], pos, computer, history) + pos.p1Pieces;
+
+  return NUM_BENCH_POSITIONS;
+}
+
+long long benchPlayout()
+{
+  static unsigned long long random = 0x853C49E6748FEA9BULL;
+  Bitboard board;
+
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    {
+      toBitboard(benchPositions[p], board);
+      benchSink = benchSink + playout(board, random);
+    }
+
+  return NUM_BENCH_POSITIONS;
+}
+
+long long benchEvaluate()
+{
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    benchSink = benchSink + evaluate(benchPositions[p], benchConfig);
+
+  return NUM_BENCH_POSITIONS;
+}
+
+long long benchRefreshAccumulator()
+{
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    {
+      refreshAccumulator(benchPositions[p], benchAccumulators[p]);
+      benchSink = benchSink + benchAccumulators[p].values[0][0];
+    }
+
+  return NUM_BENCH_POSITIONS;
+}
+
+long long benchUpdateAccumulator()
+{
+  long long calls = 0;
+
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    for(int i = 0; i < benchMoveCounts[p]; i++)
+      {
+	updateAccumulator(benchPositions[p], benchChildren[p][i], benchMoves[p][i], benchAccumulators[p], benchChildAccumulator);
+	benchSink = benchSink + benchChildAccumulator.values[1][0];
+	calls++;
+      }
+
+  return calls;
+}
+
+long long benchNetworkEvaluate()
+{
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    benchSink = benchSink + networkEvaluate(benchAccumulators[p], benchPositions[p].turn);
+
+  return NUM_BENCH_POSITIONS;
+}
+
+long long benchNetworkEvaluateScalar()
+{
+  SecondLayer *fastest = secondLayer;
+
+  secondLayer = secondLayerScalar;
+  benchNetworkEvaluate();
+  secondLayer = fastest;
+  return NUM_BENCH_POSITIONS;
+}
+
+//Without --network, the network benchmarks run on made-up
+//weights, which take just as long.
+void makeBenchNetwork()
+{
+  unsigned long long random = 0x9E3779B97F4A7C15ULL;
+
+  network = (Network *) allocateBlock(sizeof(Network), "evaluation network");
+
+  for(int i = 0; i < NETWORK_INPUTS; i++)
+    for(int k = 0; k < NETWORK_FIRST; k++)
+      network->firstWeights[i][k] = nextRandom(random) % 33 - 16;
+
+  for(int i = 0; i < NETWORK_SECOND; i++)
+    for(int k = 0; k < 2 * NETWORK_FIRST; k++)
+      network->secondWeights[i][k] = nextRandom(random) % 255 - 127;
+
+  for(int i = 0; i < NETWORK_SECOND; i++)
+    network->outputWeights[i] = nextRandom(random) % 255 - 127;
+}
+
+//Times one benchmark body and prints its summary.  The body
+//is first run for a warmup period and to find how many
+//runs take about 10ms; each of the repetitions then
+//times that many runs, and the summary is over the
+//per-call times of the repetitions.
+void runBenchmark(const char *name, long long (*body)())
+{
+  const int REPETITIONS = 21;
+  typedef chrono::steady_clock clock;
+
+  long long runs = 0, calls = 0;
+  clock::time_point start = clock::now();
+
+  while(clock::now() - start < chrono::milliseconds(100))
+    {
+      calls += body();
+      runs++;
+    }
+
+  long long callsPerRun = calls / runs;
+  long long runsPerRep = runs / 10 > 0 ? runs / 10 : 1;
+  vector<double> nsPerCall;
+
+  for(int r = 0; r < REPETITIONS; r++)
+    {
+      clock::time_point repStart = clock::now();
+
+      for(long long i = 0; i < runsPerRep; i++)
+	body();
+
+      double ns = chrono::duration_cast<chrono::nanoseconds>(clock::now() - repStart).count();
+      nsPerCall.push_back(ns / (runsPerRep * callsPerRun));
+    }
+
+  sort(nsPerCall.begin(), nsPerCall.end());
+
+  double mean = 0, variance = 0;
+
+  for(int r = 0; r < REPETITIONS; r++)
+    mean += nsPerCall[r];
+  mean /= REPETITIONS;
+
+  for(int r = 0; r < REPETITIONS; r++)
+    variance += (nsPerCall[r] - mean) * (nsPerCall[r] - mean);
+  variance /= REPETITIONS - 1;
+
+  cout << "{\"name\":\"" << name << "\",\"repetitions\":" << REPETITIONS
+       << ",\"calls_per_repetition\":" << runsPerRep * callsPerRun
+       << ",\"min_ns\":" << nsPerCall[0]
+       << ",\"median_ns\":" << nsPerCall[REPETITIONS / 2]
+       << ",\"mean_ns\":" << mean
+       << ",\"stddev_ns\":" << sqrt(variance)
+       << ",\"max_ns\":" << nsPerCall[REPETITIONS - 1] << '}' << endl;
+}
+
+void runBenchmarks()
+{
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    {
+      if(!readPosition(benchPositionText[p], benchGrids[p], benchTurns[p]))
+	{
+	  cerr << "Bad benchmark position: " << benchPositionText[p] << endl;
+	  return;
+	}
+
+      memcpy(benchPositions[p].grid, benchGrids[p], sizeof(benchGrids[p]));
+      benchPositions[p].turn = benchTurns[p];
+      countPieces(benchPositions[p].grid, benchPositions[p].p1Pieces, benchPositions[p].p2Pieces);
+      benchMoveCounts[p] = generateMoves(benchPositions[p], benchMoves[p], false);
+      toBitboard(benchPositions[p], benchBitboards[p]);
+
+      for(int i = 0; i < benchMoveCounts[p]; i++)
+	{
+	  benchChildren[p][i] = benchPositions[p];
+	  makeMove(benchChildren[p][i], benchMoves[p][i]);
+	}
+    }
+
+  readEngineConfig("", benchConfig);
+
+  if(!network)
+    makeBenchNetwork();
+
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    refreshAccumulator(benchPositions[p], benchAccumulators[p]);
+
+  runBenchmark("arrangeGrid", benchArrangeGrid);
+  runBenchmark("boardCopy", benchBoardCopy);
+  runBenchmark("validMove", benchValidMove);
+  runBenchmark("isDoubleJumpAvailable", benchDoubleJump);
+  runBenchmark("drawBoard", benchDrawBoard);
+  runBenchmark("generateMoves", benchGenerateMoves);
+  runBenchmark("makeMove", benchMakeMove);
+  runBenchmark("hashPosition", benchHashPosition);
+  runBenchmark("hashChange", benchHashChange);
+  runBenchmark("canonicalHash", benchCanonicalHash);
+  runBenchmark("canonicalize", benchCanonicalize);
+  runBenchmark("saveSnapshot", benchSaveSnapshot);
+  runBenchmark("loadSnapshot", benchLoadSnapshot);
+  runBenchmark("evaluate", benchEvaluate);
+  runBenchmark("refreshAccumulator", benchRefreshAccumulator);
+  runBenchmark("updateAccumulator", benchUpdateAccumulator);
+  runBenchmark("networkEvaluate", benchNetworkEvaluate);
+  runBenchmark("networkEvaluateScalar", benchNetworkEvaluateScalar);
+  runBenchmark("playout", benchPlayout);
+}
+
+void runSuite(const EngineConfig &config)
+{
+  Engine engine;
+  long long totalNodes = 0, totalMicros = 0;
+
+  initEngine(engine, config);
+
+  for(int p = 0; p < NUM_BENCH_POSITIONS; p++)
+    {
+      Position pos;
+      Move move;
+
+      readPosition(benchPositionText[p], pos.grid, pos.turn);
+      countPieces(pos.grid, pos.p1Pieces, pos.p2Pieces);
+
+      if(!config.mcts)
+	clearEngine(engine);
+
+      int score = think(engine, pos, move);
+      long long micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - engine.started).count();
+
+      totalNodes += engine.nodes;
+      totalMicros += micros;
+
+      cout << "{\"position\":\"" << benchPositionText[p] << "\",\"depth\":" << engine.iteration
+	   << ",\"nodes\":" << engine.nodes << ",\"ms\":" << micros / 1000.0 << ",\"score\":" << score
+	   << ",\"move\":\"" << moveText(move) << "\"}" << endl;
+    }
+
+  cout << "{\"positions\":" << NUM_BENCH_POSITIONS << ",\"nodes\":" << totalNodes << ",\"ms\":" << totalMicros / 1000.0
+       << ",\"nodes_per_second\":" << (totalMicros ? totalNodes * 1000000 / totalMicros : 0) << '}' << endl;
+}
+
+void startPosition(Position &pos)
+{
+  arrangeGrid(pos.grid);
+  pos.turn = 1;
+  pos.p1Pieces = 12;
+  pos.p2Pieces = 12;
+}
+
+//applyStep() moves the piece at (xFrom, yFrom) to (xTo, yTo)
+//if validMove() allows it, crowning it the way main() and
+//grantDoubleJump() do.  Returns false if the step is not
+//valid, in which case pos may have been changed and should
+//be thrown away.
+bool applyStep(Position &pos, int xFrom, int yFrom, int xTo, int yTo)
+{
+  int &opposing = pos.turn == 1 ? pos.p2Pieces : pos.p1Pieces;
+
+  if(!validMove(xFrom, xTo, yFrom, yTo, pos.turn, pos.grid, opposing))
+    return false;
+
+  if(pos.grid[xFrom][yFrom] == pos.turn + 2 || (pos.turn == 1 && xTo == 7) || (pos.turn == 2 && xTo == 0))
+    pos.grid[xTo][yTo] = pos.turn + 2;
+  else
+    pos.grid[xTo][yTo] = pos.turn;
+
+  pos.grid[xFrom][yFrom] = 0;
+
+  return true;
+}
+
+//addDoubleJumps() is given pos just after the jump that ends
+//move, and adds each way of carrying on jumping to moves,
+//following the jump registry as grantDoubleJump() does.
+void addDoubleJumps(Position &pos, Move &move, Move moves[], int &count)
+{
+  int x = move.path[move.length - 1][0];
+  int y = move.path[move.length - 1][1];
+  int jumpReg[4][2];
+
+  if(move.length == MAX_MOVE_PATH || !isDoubleJumpAvailable(x, y, pos.turn, pos.grid, jumpReg))
+    return;
+
+  for(int i = 0; i < 4; i++)
+    {
+      if(jumpReg[i][0] == -1)
+	continue;
+
+      Position next = pos;
+
+      if(!applyStep(next, x, y, jumpReg[i][0], jumpReg[i][1]))
+	continue;
+
+      move.path[move.length][0] = jumpReg[i][0];
+      move.path[move.length][1] = jumpReg[i][1];
+      move.length++;
+
+      if(count < MAX_MOVES)
+	moves[count++] = move;
+
+      addDoubleJumps(next, move, moves, count);
+      move.length--;
+    }
+}
+
+int generateMoves(Position &pos, Move moves[], bool jumpsOnly)
+{
+  STAT_TIME(PHASE_MOVEGEN);
+
+  //The four diagonal directions.  validMove() decides
+  //which of them a given piece may use.
+  static const int directions[4][2] = { {1, 1}, {1, -1}, {-1, 1}, {-1, -1} };
+  int count = 0;
+  Move move;
+
+  //Jumps first, since they are the moves most
+  //worth searching first.
+  for(int x = 0; x < 8; x++)
+    for(int y = 0; y < 8; y++)
+      {
+	if(pos.grid[x][y] != pos.turn && pos.grid[x][y] != pos.turn + 2)
+	  continue;
+
+	for(int d = 0; d < 4; d++)
+	  {
+	    int xTo = x + 2 * directions[d][0], yTo = y + 2 * directions[d][1];
+
+	    if(xTo < 0 || xTo > 7 || yTo < 0 || yTo > 7)
+	      continue;
+
+	    //validMove() removes the jumped piece, so
+	    //try the jump on a copy.
+	    Position next = pos;
+
+	    if(!applyStep(next, x, y, xTo, yTo))
+	      continue;
+
+	    move.path[0][0] = x;
+	    move.path[0][1] = y;
+	    move.path[1][0] = xTo;
+	    move.path[1][1] = yTo;
+	    move.length = 2;
+
+	    if(count < MAX_MOVES)
+	      moves[count++] = move;
+
+	    addDoubleJumps(next, move, moves, count);
+	  }
+      }
+
+  if(!jumpsOnly)
+    {
+      for(int x = 0; x < 8; x++)
+	for(int y = 0; y < 8; y++)
+	  {
+	    if(pos.grid[x][y] != pos.turn && pos.grid[x][y] != pos.turn + 2)
+	      continue;
+
+	    for(int d = 0; d < 4; d++)
+	      {
+		int xTo = x + directions[d][0], yTo = y + directions[d][1];
+		int unused = 0;
+
+		//A step that is not a jump leaves the board
+		//alone, so there is no need for a copy here.
+		if(xTo < 0 || xTo > 7 || yTo < 0 || yTo > 7 || !validMove(x, xTo, y, yTo, pos.turn, pos.grid, unused))
+		  continue;
+
+		move.path[0][0] = x;
+		move.path[0][1] = y;
+		move.path[1][0] = xTo;
+		move.path[1][1] = yTo;
+		move.length = 2;
+
+		if(count < MAX_MOVES)
+		  moves[count++] = move;
+	      }
+	  }
+    }
+
+  STAT_ADD(COUNT_MOVES_GENERATED, count);
+
+  return count;
+}
+
+void makeMove(Position &pos, const Move &move)
+{
+  for(int i = 1; i < move.length; i++)
+    applyStep(pos, move.path[i - 1][0], move.path[i - 1][1], move.path[i][0], move.path[i][1]);
+
+  pos.turn = pos.turn == 1 ? 2 : 1;
+}
+
+//One random number for each piece type on each square, and
+//one for player 2 being the side to move.
+unsigned long long zobristKeys[8][8][5];
+unsigned long long zobristTurn;
+
+unsigned long long nextRandom(unsigned long long &state)
+{
+  state ^= state >> 12;
+  state ^= state << 25;
+  state ^= state >> 27;
+  return state * 2685821657736338717ULL;
+}
+
+void initZobrist()
+{
+  unsigned long long state = 0x9E3779B97F4A7C15ULL;
+
+  for(int x = 0; x < 8; x++)
+    for(int y = 0; y < 8; y++)
+      for(int piece = 0; piece < 5; piece++)
+	zobristKeys[x][y][piece] = piece == 0 ? 0 : nextRandom(state);
+
+  zobristTurn = nextRandom(state);
+}
+
+unsigned long long hashPosition(const Position &pos)
+{
+  unsigned long long key = pos.turn == 2 ? zobristTurn : 0;
+
+  for(int x = 0; x < 8; x++)
+    for(int y = 0; y < 8; y++)
+      key ^= zobristKeys[x][y][pos.grid[x][y]];
+
+  return key;
+}
+
+int touchedSquares(const Move &move, int squares[][2])
+{
+  int count = 0;
+
+  for(int i = 0; i < move.length; i++)
+    {
+      squares[count][0] = move.path[i][0];
+      squares[count][1] = move.path[i][1];
+      count++;
+
+      if(i > 0 && abs(move.path[i][0] - move.path[i - 1][0]) == 2)
+	{
+	  squares[count][0] = (move.path[i][0] + move.path[i - 1][0]) / 2;
+	  squares[count][1] = (move.path[i][1] + move.path[i - 1][1]) / 2;
+	  count++;
+	}
+    }
+
+  return count;
+}
+
+unsigned long long hashChange(const Position &before, const Position &after, const Move &move)
+{
+  int squares[2 * MAX_MOVE_PATH][2];
+  int count = touchedSquares(move, squares);
+  unsigned long long key = before.turn != after.turn ? zobristTurn : 0;
+  unsigned long long done = 0;
+
+  //Each square is counted once, for what is on it before and
+  //after the whole move, as in updateAccumulator().
+  for(int i = 0; i < count; i++)
+    {
+      int x = squares[i][0], y = squares[i][1];
+
+      if(done >> (x * 8 + y) & 1)
+	continue;
+
+      done |= 1ULL << (x * 8 + y);
+      key ^= zobristKeys[x][y][before.grid[x][y]] ^ zobristKeys[x][y][after.grid[x][y]];
+    }
+
+  return key;
+}
+
+unsigned long long canonicalHash(const Position &pos, bool &flipped)
+{
+  //Canonical positions all have player 1 to move, so the turn
+  //needs no key.  Rather than building the canonical position
+  //with canonicalize(), each piece is hashed straight into the
+  //square and colour it would have there, which is as quick as
+  //hashPosition().
+  static const int flippedPiece[5] = { 0, 2, 1, 4, 3 };
+  unsigned long long key = 0;
+
+  flipped = pos.turn == 2;
+
+  if(flipped)
+    {
+      for(int x = 0; x < 8; x++)
+	for(int y = 0; y < 8; y++)
+	  key ^= zobristKeys[7 - x][7 - y][flippedPiece[pos.grid[x][y]]];
+    }
+  else
+    {
+      for(int x = 0; x < 8; x++)
+	for(int y = 0; y < 8; y++)
+	  key ^= zobristKeys[x][y][pos.grid[x][y]];
+    }
+
+  return key;
+}
+
+int evaluate(const Position &pos, const EngineConfig &config)
+{
+  STAT_TIME(PHASE_EVALUATE);
+
+  int score = 0;
+
+  //Score from player 1's side first.  Standard pieces
+  //are worth a little more the closer they are to
+  //being crowned.
+  for(int x = 0; x < 8; x++)
+    for(int y = 0; y < 8; y++)
+      {
+	switch(pos.grid[x][y])
+	  {
+	  case 1: score += 100 + 4 * x; break;
+	  case 2: score -= 100 + 4 * (7 - x); break;
+	  case 3: score += config.kingValue; break;
+	  case 4: score -= config.kingValue; break;
+	  }
+      }
+
+  return pos.turn == 1 ? score : -score;
+}
+
+//The size of a network file: the magic number, then the
+//weights and biases as 16-bit, 16-bit, 8-bit, 32-bit, 8-bit
+//and 32-bit numbers.
+const size_t NETWORK_FILE_BYTES = 4 + NETWORK_INPUTS * NETWORK_FIRST * 2 + NETWORK_FIRST * 2
+  + NETWORK_SECOND * 2 * NETWORK_FIRST + NETWORK_SECOND * 4 + NETWORK_SECOND + 4;
+
+//readLittle() reads a signed little-endian number of size bytes
+//from data and moves data past it.
+long long readLittle(const unsigned char *&data, int size)
+{
+  unsigned long long value = 0;
+  int unused = 64 - 8 * size;
+
+  for(int i = 0; i < size; i++)
+    value |= (unsigned long long) data[i] << (8 * i);
+
+  data += size;
+  return (long long) (value << unused) >> unused;
+}
+
+bool loadNetwork(const char *file)
+{
+  vector<unsigned char> bytes(NETWORK_FILE_BYTES + 1);
+  ifstream in(file, ios::binary);
+
+  //Read one byte more than there should be, to catch a file
+  //that is too long.
+  in.read((char *) bytes.data(), bytes.size());
+
+  if((size_t) in.gcount() != NETWORK_FILE_BYTES || memcmp(bytes.data(), "CKNN", 4) != 0)
+    return false;
+
+  const unsigned char *data = bytes.data() + 4;
+  Network *loaded = (Network *) allocateBlock(sizeof(Network), "evaluation network");
+
+  for(int i = 0; i < NETWORK_INPUTS; i++)
+    for(int k = 0; k < NETWORK_FIRST; k++)
+      loaded->firstWeights[i][k] = readLittle(data, 2);
+
+  for(int k = 0; k < NETWORK_FIRST; k++)
+    loaded->firstBiases[k] = readLittle(data, 2);
+
+  for(int i = 0; i < NETWORK_SECOND; i++)
+    for(int k = 0; k < 2 * NETWORK_FIRST; k++)
+      loaded->secondWeights[i][k] = readLittle(data, 1);
+
+  for(int i = 0; i < NETWORK_SECOND; i++)
+    loaded->secondBiases[i] = readLittle(data, 4);
+
+  for(int i = 0; i < NETWORK_SECOND; i++)
+    loaded->outputWeights[i] = readLittle(data, 1);
+
+  loaded->outputBias = readLittle(data, 4);
+  network = loaded;
+  return true;
+}
+
+//networkInput() returns the input that piece on grid[x][y]
+//feeds from side's point of view: 0 for player 1's, 1 for
+//player 2's.
+inline int networkInput(int side, int x, int y, int piece)
+{
+  int square = x * 4 + y / 2;
+
+  if(side == 1)
+    return ((piece - 1) ^ 1) * 32 + 31 - square;
+
+  return (piece - 1) * 32 + square;
+}
+
+//addInput() adds the first-layer weights of input to values,
+//or takes them away if remove is set.
+inline void addInput(short *__restrict values, int input, bool remove)
+{
+  const short *weights = network->firstWeights[input];
+
+  if(remove)
+    for(int i = 0; i < NETWORK_FIRST; i++)
+      values[i] -= weights[i];
+  else
+    for(int i = 0; i < NETWORK_FIRST; i++)
+      values[i] += weights[i];
+}
+
+void refreshAccumulator(const Position &pos, Accumulator &accumulator)
+{
+  for(int side = 0; side < 2; side++)
+    {
+      memcpy(accumulator.values[side], network->firstBiases, sizeof(network->firstBiases));
+
+      for(int x = 0; x < 8; x++)
+	for(int y = (x + 1) % 2; y < 8; y += 2)
+	  if(pos.grid[x][y])
+	    addInput(accumulator.values[side], networkInput(side, x, y, pos.grid[x][y]), false);
+    }
+}
+
+void updateAccumulator(const Position &before, const Position &after, const Move &move, const Accumulator &from, Accumulator &to)
+{
+  int squares[2 * MAX_MOVE_PATH][2];
+  int count = touchedSquares(move, squares);
+  unsigned long long done = 0;
+
+  to = from;
+
+  //A King can pass the same square twice in a double jump, or
+  //end where it started, so each square is looked at once, and
+  //only for what is on it before and after the whole move.
+  for(int i = 0; i < count; i++)
+    {
+      int x = squares[i][0], y = squares[i][1];
+      int old = before.grid[x][y], now = after.grid[x][y];
+
+      if(old == now || (done >> (x * 8 + y) & 1))
+	continue;
+
+      done |= 1ULL << (x * 8 + y);
+
+      for(int side = 0; side < 2; side++)
+	{
+	  if(old)
+	    addInput(to.values[side], networkInput(side, x, y, old), true);
+	  if(now)
+	    addInput(to.values[side], networkInput(side, x, y, now), false);
+	}
+    }
+}
+
+void secondLayerScalar(const short own[], const short other[], int second[])
+{
+  unsigned char first[2 * NETWORK_FIRST];
+
+  for(int k = 0; k < NETWORK_FIRST; k++)
+    {
+      first[k] = min(max((int) own[k], 0), 127);
+      first[NETWORK_FIRST + k] = min(max((int) other[k], 0), 127);
+    }
+
+  for(int i = 0; i < NETWORK_SECOND; i++)
+    {
+      const signed char *weights = network->secondWeights[i];
+      int sum = network->secondBiases[i];
+
+      for(int k = 0; k < 2 * NETWORK_FIRST; k++)
+	sum += first[k] * weights[k];
+
+      second[i] = min(max(sum >> 6, 0), 127);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+//The first layer is clipped 32 values at a time by packing
+//them into unsigned bytes, which saturates at 0, and then
+//taking the smaller of each and 127.  _mm256_maddubs_epi16()
+//multiplies those by the weights (signed bytes) and adds
+//neighbouring products in 16 bits, saturating, which two
+//products of at most 127 * 128 never do; _mm256_madd_epi16()
+//by ones adds neighbouring pairs of those in 32 bits.  Eight
+//rows of weights are done at once, so that their sums can be
+//added across lanes together.
+__attribute__((target("avx2")))
+void secondLayerAvx2(const short own[], const short other[], int second[])
+{
+  const int CHUNKS = 2 * NETWORK_FIRST / 32;
+  const __m256i ones = _mm256_set1_epi16(1), top = _mm256_set1_epi8(127);
+  __m256i first[CHUNKS];
+
+  for(int c = 0; c < CHUNKS; c++)
+    {
+      const short *values = c < CHUNKS / 2 ? own + 32 * c : other + 32 * (c - CHUNKS / 2);
+      __m256i packed = _mm256_packus_epi16(_mm256_loadu_si256((const __m256i *) values),
+					   _mm256_loadu_si256((const __m256i *) (values + 16)));
+
+      //Packing works within each half of the register, so the
+      //middle two quarters come out swapped.
+      first[c] = _mm256_min_epu8(_mm256_permute4x64_epi64(packed, 0xD8), top);
+    }
+
+  for(int i = 0; i < NETWORK_SECOND; i += 8)
+    {
+      __m256i sums[8];
+
+      for(int r = 0; r < 8; r++)
+	{
+	  const signed char *weights = network->secondWeights[i + r];
+
+	  sums[r] = _mm256_setzero_si256();
+
+	  for(int c = 0; c < CHUNKS; c++)
+	    {
+	      __m256i products = _mm256_maddubs_epi16(first[c], _mm256_loadu_si256((const __m256i *) (weights + 32 * c)));
+	      sums[r] = _mm256_add_epi32(sums[r], _mm256_madd_epi16(products, ones));
+	    }
+	}
+
+      //Each of these holds, in lane r of each half, row r's sum
+      //over that half of the register.
+      __m256i low = _mm256_hadd_epi32(_mm256_hadd_epi32(sums[0], sums[1]), _mm256_hadd_epi32(sums[2], sums[3]));
+      __m256i high = _mm256_hadd_epi32(_mm256_hadd_epi32(sums[4], sums[5]), _mm256_hadd_epi32(sums[6], sums[7]));
+      __m256i totals = _mm256_add_epi32(_mm256_permute2x128_si256(low, high, 0x20), _mm256_permute2x128_si256(low, high, 0x31));
+
+      totals = _mm256_add_epi32(totals, _mm256_loadu_si256((const __m256i *) (network->secondBiases + i)));
+      totals = _mm256_srai_epi32(totals, 6);
+      totals = _mm256_min_epi32(_mm256_max_epi32(totals, _mm256_setzero_si256()), _mm256_set1_epi32(127));
+      _mm256_storeu_si256((__m256i *) (second + i), totals);
+    }
+}
+#endif
+
+SecondLayer *pickSecondLayer()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+
+  if(__builtin_cpu_supports("avx2"))
+    return secondLayerAvx2;
+#endif
+
+  return secondLayerScalar;
+}
+
+int networkEvaluate(const Accumulator &accumulator, int turn)
+{
+  STAT_TIME(PHASE_EVALUATE);
+
+  int second[NETWORK_SECOND];
+  int output = network->outputBias;
+
+  secondLayer(accumulator.values[turn - 1], accumulator.values[2 - turn], second);
+
+  for(int i = 0; i < NETWORK_SECOND; i++)
+    output += second[i] * network->outputWeights[i];
+
+  //Scores past WIN_BOUND are for wins and losses the search
+  //has found.
+  return min(max(output / NETWORK_OUTPUT_SCALE, -WIN_BOUND), WIN_BOUND);
+}
+
+bool readEngineConfig(const char *text, EngineConfig &config)
+{
+  config.depth = 6;
+  config.nodes = 0;
+  config.tableBits = 20;
+  config.kingValue = 150;
+  config.mcts = false;
+  config.playouts = 0;
+  config.moveTime = 0;
+  config.threads = 1;
+  config.treeNodes = 1000000;
+  config.pvs = true;
+  config.aspiration = 40;
+  config.lmr = true;
+  config.probcut = true;
+  config.useNetwork = false;
+  config.evalCacheBits = 0;
+
+  while(*text != '\0')
+    {
+      const char *equals = strchr(text, '=');
+
+      if(!equals)
+	return false;
+
+      string key(text, equals - text);
+      char *end;
+      long long value = strtoll(equals + 1, &end, 10);
+
+      if(end == equals + 1 || (*end != ',' && *end != '\0'))
+	return false;
+
+      if(key == "depth" && value >= 1 && value <= 64)
+	config.depth = value;
+      else if(key == "nodes" && value >= 0)
+	config.nodes = value;
+      else if(key == "table" && value >= 10 && value <= 30)
+	config.tableBits = value;
+      else if(key == "king" && value >= 0)
+	config.kingValue = value;
+      else if(key == "mcts" && (value == 0 || value == 1))
+	config.mcts = value;
+      else if(key == "playouts" && value >= 0)
+	config.playouts = value;
+      else if(key == "ms" && value >= 0)
+	config.moveTime = value;
+      else if(key == "threads" && value >= 1 && value <= 256)
+	config.threads = value;
+      else if(key == "tree" && value >= 1000)
+	config.treeNodes = value;
+      else if(key == "pvs" && (value == 0 || value == 1))
+	config.pvs = value;
+      else if(key == "aspiration" && value >= 0)
+	config.aspiration = value;
+      else if(key == "lmr" && (value == 0 || value == 1))
+	config.lmr = value;
+      else if(key == "probcut" && (value == 0 || value == 1))
+	config.probcut = value;
+      else if(key == "nn" && (value == 0 || (value == 1 && network)))
+	config.useNetwork = value;
+      else if(key == "evalcache" && (value == 0 || (value >= 8 && value <= 24)))
+	config.evalCacheBits = value;
+      else
+	return false;
+
+      text = *end == ',' ? end + 1 : end;
+    }
+
+  return true;
+}
+
+void initEngine(Engine &engine, const EngineConfig &config)
+{
+  engine.config = config;
+  engine.table = NULL;
+  engine.tableSize = 0;
+  engine.nodes = 0;
+  engine.nodeLimit = 0;
+  engine.stopped = false;
+  engine.rootMove.length = 0;
+  engine.accumulators = NULL;
+  engine.evalCache = NULL;
+  engine.evalCacheSize = 0;
+  engine.evalKeys = NULL;
+  engine.tree = NULL;
+  engine.treeTop = 0;
+  engine.pool.reset();
+  engine.poll = NULL;
+  engine.pollContext = NULL;
+  engine.moveNow = false;
+  engine.iteration = 0;
+
+  //An MCTS player never looks at the transposition table.
+  if(config.mcts)
+    engine.tree = (MctsNode *) allocateBlock(engineBytes(config), "MCTS node pools");
+  else
+    {
+      engine.tableSize = size_t(1) << config.tableBits;
+      engine.table = (TableEntry *) allocateBlock(engine.tableSize * sizeof(TableEntry), "transposition tables");
+
+      if(config.useNetwork)
+	engine.accumulators = (Accumulator *) allocateBlock(MAX_SEARCH_PLY * sizeof(Accumulator), "network accumulators");
+
+      if(config.evalCacheBits)
+	{
+	  engine.evalCacheSize = size_t(1) << config.evalCacheBits;
+	  engine.evalCache = (EvalEntry *) allocateBlock(engine.evalCacheSize * sizeof(EvalEntry), "evaluation caches");
+	  engine.evalKeys = (unsigned long long *) allocateBlock(MAX_SEARCH_PLY * sizeof(unsigned long long), "evaluation caches");
+	}
+    }
+}
+
+void clearEngine(Engine &engine)
+{
+  fill(engine.table, engine.table + engine.tableSize, TableEntry());
+}
+
+size_t engineBytes(const EngineConfig &config)
+{
+  if(config.mcts)
+    return config.treeNodes * sizeof(MctsNode);
+
+  size_t bytes = (size_t(1) << config.tableBits) * sizeof(TableEntry);
+
+  if(config.useNetwork)
+    bytes += MAX_SEARCH_PLY * sizeof(Accumulator);
+
+  if(config.evalCacheBits)
+    bytes += (size_t(1) << config.evalCacheBits) * sizeof(EvalEntry) + MAX_SEARCH_PLY * sizeof(unsigned long long);
+
+  return bytes;
+}
+
+bool fitEngine(EngineConfig &config, size_t bytes)
+{
+  if(config.mcts)
+    {
+      //allocateBlock() rounds the pool up to a whole number
+      //of cache lines.
+      if(bytes > BLOCK_ALIGNMENT)
+	config.treeNodes = min(config.treeNodes, (long long) ((bytes - BLOCK_ALIGNMENT) / sizeof(MctsNode)));
+      return bytes > BLOCK_ALIGNMENT && config.treeNodes >= 1000;
+    }
+
+  while(config.tableBits > 10 && engineBytes(config) > bytes)
+    config.tableBits--;
+
+  return engineBytes(config) <= bytes;
+}
+
+//Win and loss scores count plies from the root, but the
+//table must hold them counted from the position itself, so
+//that they are right wherever the position turns up again.
+int scoreToTable(int score, int ply)
+{
+  if(score > WIN_BOUND)
+    return score + ply;
+  if(score < -WIN_BOUND)
+    return score - ply;
+  return score;
+}
+
+int scoreFromTable(int score, int ply)
+{
+  if(score > WIN_BOUND)
+    return score - ply;
+  if(score < -WIN_BOUND)
+    return score + ply;
+  return score;
+}
+
+//The search looks at the clock, and calls the engine's poll
+//hook, once every this many nodes.
+const long long ENGINE_POLL_NODES = 4096;
+
+//pollEngine() is called by the search every ENGINE_POLL_NODES
+//nodes.  It stops the search if the time for the move is up or
+//poll asks it to, except in the first iteration, which always
+//runs to the end so that there is a move to play.
+void pollEngine(Engine &engine)
+{
+  engine.nextPoll = engine.nodes + ENGINE_POLL_NODES;
+
+  if(engine.poll)
+    engine.poll(engine);
+
+  if(engine.iteration <= 1)
+    return;
+
+  if(engine.moveNow)
+    engine.stopped = true;
+  else if(engine.config.moveTime > 0
+	  && chrono::steady_clock::now() - engine.started >= chrono::milliseconds(engine.config.moveTime))
+    engine.stopped = true;
+}
+
+//enterRoot() sets up what the engine keeps for each ply of the
+//search for pos, at ply 0: the network's first layer and the
+//hash for the evaluation cache, for the players that use them.
+//enterChild() works them out for ply + 1, where child is, from
+//those for ply, where pos is, when move takes pos to child.
+void enterRoot(Engine &engine, const Position &pos)
+{
+  if(engine.accumulators)
+    refreshAccumulator(pos, engine.accumulators[0]);
+
+  if(engine.evalKeys)
+    engine.evalKeys[0] = hashPosition(pos);
+}
+
+void enterChild(Engine &engine, const Position &pos, const Position &child, const Move &move, int ply)
+{
+  if(engine.accumulators)
+    updateAccumulator(pos, child, move, engine.accumulators[ply], engine.accumulators[ply + 1]);
+
+  if(engine.evalKeys)
+    {
+      STAT_TIME(PHASE_EVAL_CACHE);
+      engine.evalKeys[ply + 1] = engine.evalKeys[ply] ^ hashChange(pos, child, move);
+    }
+}
+
+//staticScore() returns the static evaluation of pos, at ply
+//of the search, by the network or evaluate(), looking it up in
+//the engine's evaluation cache first if it has one.  A cache
+//entry is simply overwritten by the next position that maps
+//to it.
+int staticScore(Engine &engine, const Position &pos, int ply)
+{
+  EvalEntry *entry = NULL;
+  unsigned int check = 0;
+
+  if(engine.evalCache)
+    {
+      STAT_TIME(PHASE_EVAL_CACHE);
+
+      unsigned long long key = engine.evalKeys[ply];
+
+      entry = &engine.evalCache[key & (engine.evalCacheSize - 1)];
+      check = key >> 32;
+      STAT_COUNT(COUNT_EVAL_CACHE_PROBES);
+
+      if(entry->check == check)
+	{
+	  STAT_COUNT(COUNT_EVAL_CACHE_HITS);
+	  return entry->score;
+	}
+    }
+
+  int score = engine.accumulators ? networkEvaluate(engine.accumulators[ply], pos.turn) : evaluate(pos, engine.config);
+
+  if(entry)
+    {
+      entry->check = check;
+      entry->score = score;
+    }
+
+  return score;
+}
+
+//quiesce() searches only jumps, so that the search never stops
+//to evaluate a position in the middle of an exchange.  Jumping
+//is not forced, so the side to move can always choose to
+//stand on the static evaluation instead.
+int quiesce(Engine &engine, Position &pos, int alpha, int beta, int ply)
+{
+  engine.nodes++;
+  STAT_COUNT(COUNT_NODES);
+
+  if((pos.turn == 1 ? pos.p1Pieces : pos.p2Pieces) == 0)
+    return -WIN_SCORE + ply;
+
+  int best = staticScore(engine, pos, ply);
+
+  if(best >= beta)
+    return best;
+  if(best > alpha)
+    alpha = best;
+
+  Move moves[MAX_MOVES];
+  int count = generateMoves(pos, moves, true);
+
+  for(int i = 0; i < count; i++)
+    {
+      Position child = pos;
+      makeMove(child, moves[i]);
+      enterChild(engine, pos, child, moves[i], ply);
+
+      int score = -quiesce(engine, child, -beta, -alpha, ply + 1);
+
+      if(score > best)
+	{
+	  best = score;
+	  if(score > alpha)
+	    alpha = score;
+	  if(score >= beta)
+	    break;
+	}
+    }
+
+  return best;
+}
+
+//Late move reductions: at depth LMR_MIN_DEPTH or more, quiet
+//moves from the LMR_FULL_MOVES-th on are searched a ply less
+//deep, and from the LMR_DEEPER_MOVES-th on two plies less, at
+//first.  Jumps and moves that crown are never reduced, and
+//nothing is reduced while the side to move has a jump, since
+//with jumping not forced the quiet moves there are the ones
+//that give a piece away.
+const int LMR_MIN_DEPTH = 3;
+const int LMR_FULL_MOVES = 3;
+const int LMR_DEEPER_MOVES = 8;
+
+//ProbCut: at depth PROBCUT_MIN_DEPTH or more, outside the
+//principal variation, a search PROBCUT_REDUCTION plies
+//shallower that clears beta (or falls short of alpha) by
+//PROBCUT_MARGIN is taken to mean the full search would too.
+const int PROBCUT_MIN_DEPTH = 5;
+const int PROBCUT_REDUCTION = 4;
+const int PROBCUT_MARGIN = 80;
+
+//Aspiration windows are used from this iteration on; earlier
+//scores are too rough to aim at.
+const int ASPIRATION_MIN_DEPTH = 3;
+
+//isQuiet() returns whether move, in pos, neither jumps nor
+//crowns a piece.
+bool isQuiet(const Position &pos, const Move &move)
+{
+  const int *from = move.path[0], *to = move.path[move.length - 1];
+
+  if(abs(move.path[1][0] - from[0]) == 2)
+    return false;
+
+  return pos.grid[from[0]][from[1]] > 2 || to[0] != (pos.turn == 1 ? 7 : 0);
+}
+
+//alphaBeta() is a fail-soft negamax alpha-beta search of pos to
+//depth plies.  At the root (ply 0) it also leaves the best move
+//in engine.rootMove.  Each of the refinements in engine.config
+//is applied only if it is switched on: ProbCut, principal
+//variation search (every move after the first is first searched
+//with a null window, and again with the full one only if it
+//beats alpha) and late move reductions.
+int alphaBeta(Engine &engine, Position &pos, int depth, int alpha, int beta, int ply)
+{
+  if(depth <= 0)
+    return quiesce(engine, pos, alpha, beta, ply);
+
+  engine.nodes++;
+  STAT_COUNT(COUNT_NODES);
+
+  if(engine.nodeLimit && engine.nodes >= engine.nodeLimit)
+    engine.stopped = true;
+
+  if(engine.nodes >= engine.nextPoll)
+    pollEngine(engine);
+
+  if(engine.stopped)
+    return 0;
+
+  if((pos.turn == 1 ? pos.p1Pieces : pos.p2Pieces) == 0)
+    return -WIN_SCORE + ply;
+
+  bool flipped;
+  unsigned long long key = canonicalHash(pos, flipped);
+  TableEntry &entry = engine.table[key & (engine.tableSize - 1)];
+  int tableFrom = -1, tableTo = -1;
+
+  STAT_COUNT(COUNT_TT_PROBES);
+
+  if(entry.key == key)
+    {
+      STAT_COUNT(COUNT_TT_HITS);
+      tableFrom = flipped ? 63 - entry.bestFrom : entry.bestFrom;
+      tableTo = flipped ? 63 - entry.bestTo : entry.bestTo;
+
+      //At the root we need a move as well as a score,
+      //so the table may not cut the search short.
+      if(entry.depth >= depth && ply > 0)
+	{
+	  int score = scoreFromTable(entry.score, ply);
+
+	  if(entry.bound == BOUND_EXACT || (entry.bound == BOUND_LOWER && score >= beta) || (entry.bound == BOUND_UPPER && score <= alpha))
+	    return score;
+	}
+    }
+
+  //Only null-window searches are cut, so that the principal
+  //variation itself is always searched in full.
+  if(engine.config.probcut && ply > 0 && beta - alpha == 1 && depth >= PROBCUT_MIN_DEPTH
+     && beta < WIN_BOUND && alpha > -WIN_BOUND)
+    {
+      int high = beta + PROBCUT_MARGIN, low = alpha - PROBCUT_MARGIN;
+
+      if(alphaBeta(engine, pos, depth - PROBCUT_REDUCTION, high - 1, high, ply) >= high && !engine.stopped)
+	{
+	  STAT_COUNT(COUNT_PROBCUTS);
+	  return beta;
+	}
+
+      if(alphaBeta(engine, pos, depth - PROBCUT_REDUCTION, low, low + 1, ply) <= low && !engine.stopped)
+	{
+	  STAT_COUNT(COUNT_PROBCUTS);
+	  return alpha;
+	}
+
+      if(engine.stopped)
+	return 0;
+    }
+
+  Move moves[MAX_MOVES];
+  int count = generateMoves(pos, moves, false);
+
+  //No moves left is a loss, just like no pieces left.
+  if(count == 0)
+    return -WIN_SCORE + ply;
+
+  //Search the move the table remembers first.  Only its ends
+  //are remembered, so if two moves share them (which takes two
+  //different double jumps between the same squares) the first
+  //is taken.
+  int order[MAX_MOVES];
+  int tableMove = -1;
+
+  for(int i = 0; i < count; i++)
+    {
+      order[i] = i;
+
+      const int *from = moves[i].path[0], *to = moves[i].path[moves[i].length - 1];
+
+      if(tableMove < 0 && from[0] * 8 + from[1] == tableFrom && to[0] * 8 + to[1] == tableTo)
+	tableMove = i;
+    }
+
+  if(tableMove > 0)
+    {
+      order[0] = tableMove;
+      order[tableMove] = 0;
+    }
+
+  int originalAlpha = alpha;
+  int best = -INFINITE_SCORE, bestIndex = 0;
+
+  //Jumps come first, so if there are any, moves[0] is one.
+  bool canJump = abs(moves[0].path[1][0] - moves[0].path[0][0]) == 2;
+
+  for(int k = 0; k < count; k++)
+    {
+      int i = order[k];
+      Position child = pos;
+      makeMove(child, moves[i]);
+      enterChild(engine, pos, child, moves[i], ply);
+
+      int score;
+
+      if(k == 0)
+	score = -alphaBeta(engine, child, depth - 1, -beta, -alpha, ply + 1);
+      else
+	{
+	  int reduction = 0;
+	  int window = engine.config.pvs ? alpha + 1 : beta;
+
+	  if(engine.config.lmr && depth >= LMR_MIN_DEPTH && k >= LMR_FULL_MOVES && !canJump && isQuiet(pos, moves[i]))
+	    {
+	      reduction = k >= LMR_DEEPER_MOVES && depth > LMR_MIN_DEPTH ? 2 : 1;
+	      STAT_COUNT(COUNT_LMR_REDUCTIONS);
+	    }
+
+	  score = -alphaBeta(engine, child, depth - 1 - reduction, -window, -alpha, ply + 1);
+
+	  if(reduction > 0 && score > alpha && !engine.stopped)
+	    {
+	      STAT_COUNT(COUNT_LMR_RESEARCHES);
+	      score = -alphaBeta(engine, child, depth - 1, -window, -alpha, ply + 1);
+	    }
+
+	  if(window != beta && score > alpha && score < beta && !engine.stopped)
+	    {
+	      STAT_COUNT(COUNT_PVS_RESEARCHES);
+	      score = -alphaBeta(engine, child, depth - 1, -beta, -alpha, ply + 1);
+	    }
+	}
+
+      if(engine.stopped)
+	break;
+
+      if(score > best)
+	{
+	  best = score;
+	  bestIndex = i;
+
+	  if(score > alpha)
+	    alpha = score;
+
+	  if(score >= beta)
+	    {
+	      STAT_COUNT(COUNT_BETA_CUTOFFS);
+	      if(k == 0)
+		STAT_COUNT(COUNT_FIRST_MOVE_CUTOFFS);
+	      break;
+	    }
+	}
+    }
+
+  if(ply == 0 && best > -INFINITE_SCORE)
+    engine.rootMove = moves[bestIndex];
+
+  if(engine.stopped)
+    return 0;
+
+  //Keep the deeper of the two searches if the entry already
+  //holds this position, and always replace anything else.
+  if(entry.key != key || depth >= entry.depth)
+    {
+      STAT_COUNT(COUNT_TT_STORES);
+      entry.key = key;
+      entry.score = scoreToTable(best, ply);
+      entry.depth = depth;
+
+      const int *from = moves[bestIndex].path[0], *to = moves[bestIndex].path[moves[bestIndex].length - 1];
+
+      entry.bestFrom = flipped ? 63 - (from[0] * 8 + from[1]) : from[0] * 8 + from[1];
+      entry.bestTo = flipped ? 63 - (to[0] * 8 + to[1]) : to[0] * 8 + to[1];
+
+      if(best <= originalAlpha)
+	entry.bound = BOUND_UPPER;
+      else if(best >= beta)
+	entry.bound = BOUND_LOWER;
+      else
+	entry.bound = BOUND_EXACT;
+    }
+
+  return best;
+}
+
+int think(Engine &engine, Position &pos, Move &best)
+{
+  STAT_TIME(PHASE_SEARCH);
+  TRACE_SCOPE("think");
+
+  engine.started = chrono::steady_clock::now();
+  engine.moveNow = false;
+  engine.iteration = 0;
+
+  if(engine.config.mcts)
+    return mctsThink(engine, pos, best);
+
+  int score = 0;
+
+  engine.nodes = 0;
+  engine.nextPoll = ENGINE_POLL_NODES;
+  engine.stopped = false;
+  best.length = 0;
+
+  enterRoot(engine, pos);
+
+  for(int depth = 1; depth <= engine.config.depth; depth++)
+    {
+      TRACE_SCOPE("iteration");
+
+      //The first iteration always runs to the end, so
+      //that there is a move to play whatever the limit.
+      engine.nodeLimit = depth == 1 ? 0 : engine.config.nodes;
+      engine.rootMove.length = 0;
+      engine.iteration = depth;
+
+      //Search a window around the last iteration's score,
+      //widening it on whichever side the score falls out of
+      //until it falls inside.
+      int delta = engine.config.aspiration;
+      int alpha = -INFINITE_SCORE, beta = INFINITE_SCORE;
+      int iterationScore;
+
+      if(delta > 0 && depth >= ASPIRATION_MIN_DEPTH && score < WIN_BOUND && score > -WIN_BOUND)
+	{
+	  alpha = score - delta;
+	  beta = score + delta;
+	}
+
+      while(true)
+	{
+	  iterationScore = alphaBeta(engine, pos, depth, alpha, beta, 0);
+
+	  if(engine.stopped || (iterationScore > alpha && iterationScore < beta))
+	    break;
+
+	  STAT_COUNT(COUNT_ASPIRATION_FAILS);
+	  delta *= 2;
+
+	  if(iterationScore <= alpha)
+	    alpha = delta < WIN_SCORE / 8 ? score - delta : -INFINITE_SCORE;
+	  else
+	    beta = delta < WIN_SCORE / 8 ? score + delta : INFINITE_SCORE;
+	}
+
+      if(engine.stopped)
+	break;
+
+      score = iterationScore;
+      best = engine.rootMove;
+
+      //There is no point looking deeper once the
+      //outcome is known, or once asked to move.
+      if(score > WIN_BOUND || score < -WIN_BOUND || engine.moveNow)
+	break;
+    }
+
+  return score;
+}
+
+void showThinking(Engine &engine)
+{
+  ThinkingDisplay &display = *(ThinkingDisplay *) engine.pollContext;
+  long long tenths = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - engine.started).count() / 100;
+
+  if(tenths != display.drawn)
+    {
+      display.drawn = tenths;
+      cout << '\r' << tenths / 10 << '.' << tenths % 10 << 's';
+
+      if(engine.config.mcts)
+	cout << "  " << engine.nodes << " playouts";
+      else
+	cout << "  depth " << engine.iteration << "  " << engine.nodes << " nodes";
+
+      cout << "   " << flush;
+    }
+
+#if defined(__unix__) || defined(__APPLE__)
+  if(cin.rdbuf() != &terminalInput)
+    return;
+
+  terminalInput.poll();
+
+  if(terminalInput.takeLine("0"))
+    display.quit = engine.moveNow = true;
+  else if(terminalInput.takeLine("stop") || terminalInput.takeLine("now"))
+    engine.moveNow = true;
+#endif
+}
+
+#if defined(__unix__) || defined(__APPLE__)
+void TerminalInput::poll()
+{
+  fd_set waiting;
+  timeval now = { 0, 0 };
+  char buffer[256];
+
+  FD_ZERO(&waiting);
+  FD_SET(STDIN_FILENO, &waiting);
+
+  if(select(STDIN_FILENO + 1, &waiting, NULL, NULL, &now) <= 0)
+    return;
+
+  ssize_t length = read(STDIN_FILENO, buffer, sizeof(buffer));
+
+  if(length <= 0)
+    return;
+
+  //Drop what std::cin has read already, then point its get
+  //area at the rest again, since text may have moved.
+  text.erase(0, gptr() - eback());
+  text.append(buffer, length);
+  setg(&text[0], &text[0], &text[0] + text.size());
+}
+
+bool TerminalInput::takeLine(const char *word)
+{
+  size_t read = gptr() - eback();
+  size_t length = strlen(word);
+
+  for(size_t start = read, end; (end = text.find('\n', start)) != string::npos; start = end + 1)
+    {
+      if(end - start != length || text.compare(start, length, word) != 0)
+	continue;
+
+      text.erase(start, length + 1);
+      setg(&text[0], &text[0] + read, &text[0] + text.size());
+      return true;
+    }
+
+  return false;
+}
+
+//underflow() is called once std::cin has read all of text,
+//and waits for the next line.
+int TerminalInput::underflow()
+{
+  char buffer[256];
+  ssize_t length;
+
+  do
+    length = read(STDIN_FILENO, buffer, sizeof(buffer));
+  while(length < 0 && errno == EINTR);
+
+  if(length <= 0)
+    return traits_type::eof();
+
+  text.assign(buffer, length);
+  setg(&text[0], &text[0], &text[0] + text.size());
+
+  return traits_type::to_int_type(text[0]);
+}
+#endif
+
+string moveText(const Move &move)
+{
+  string text;
+
+  for(int i = 0; i < move.length; i++)
+    {
+      if(i > 0)
+	text += '-';
+      text += char('1' + move.path[i][0]);
+      text += char('1' + move.path[i][1]);
+    }
+
+  return text;
+}
+
+bool readMove(const char *text, Move &move)
+{
+  move.length = 0;
+
+  while(true)
+    {
+      if(move.length == MAX_MOVE_PATH || text[0] < '1' || text[0] > '8' || text[1] < '1' || text[1] > '8')
+	return false;
+
+      move.path[move.length][0] = text[0] - '1';
+      move.path[move.length][1] = text[1] - '1';
+      move.length++;
+      text += 2;
+
+      if(*text == '\0')
+	return move.length >= 2;
+      if(*text++ != '-')
+	return false;
+    }
+}
+
+int findMove(Position &pos, const Move &move)
+{
+  Move moves[MAX_MOVES];
+  int count = generateMoves(pos, moves, false);
+
+  for(int i = 0; i < count; i++)
+    {
+      if(moves[i].length == move.length
+	 && memcmp(moves[i].path, move.path, move.length * sizeof(move.path[0])) == 0)
+	return i;
+    }
+
+  return -1;
+}
+
+unsigned short packMove(const Move &move)
+{
+  const int *from = move.path[0], *to = move.path[move.length - 1];
+  int jumps = abs(move.path[1][0] - from[0]) == 2 ? move.length - 1 : 0;
+
+  return (from[0] * 4 + from[1] / 2) | (to[0] * 4 + to[1] / 2) << 5 | jumps << 10;
+}
+
+string packedMoveText(unsigned short packed)
+{
+  int from = packed & 31, to = packed >> 5 & 31;
+  string text;
+
+  //Row x's playable squares are in the odd columns if x is
+  //even, and the even ones if it is odd.
+  text += char('1' + from / 4);
+  text += char('1' + from % 4 * 2 + (from / 4 + 1) % 2);
+  text += (packed >> 10) > 1 ? "-...-" : "-";
+  text += char('1' + to / 4);
+  text += char('1' + to % 4 * 2 + (to / 4 + 1) % 2);
+
+  return text;
+}
+
+void recordMove(GameHistory &history, const Move &move)
+{
+  if(history.length == SNAPSHOT_HISTORY)
+    {
+      memmove(history.moves, history.moves + 1, (SNAPSHOT_HISTORY - 1) * sizeof(history.moves[0]));
+      history.length--;
+    }
+
+  history.moves[history.length++] = packMove(move);
+  history.plies++;
+}
+
+void saveSnapshot(const Position &pos, int computer, const GameHistory &history, Snapshot &snapshot)
+{
+  memset(&snapshot, 0, sizeof(snapshot));
+
+  for(int x = 0; x < 8; x++)
+    for(int y = (x + 1) % 2; y < 8; y += 2)
+      {
+	int piece = pos.grid[x][y];
+	unsigned int bit = 1U << (x * 4 + y / 2);
+
+	if(piece == 0)
+	  continue;
+
+	snapshot.pieces[piece % 2 == 1 ? 0 : 1] |= bit;
+
+	if(piece > 2)
+	  snapshot.kings |= bit;
+      }
+
+  snapshot.magic = SNAPSHOT_MAGIC;
+  snapshot.plies = min(history.plies, 0xFFFF);
+  snapshot.turn = pos.turn;
+  snapshot.computer = computer;
+  snapshot.historyLength = history.length;
+  memcpy(snapshot.history, history.moves, history.length * sizeof(history.moves[0]));
+}
+
+bool loadSnapshot(const Snapshot &snapshot, Position &pos, int &computer, GameHistory &history)
+{
+  if(snapshot.magic != SNAPSHOT_MAGIC || (snapshot.turn != 1 && snapshot.turn != 2)
+     || snapshot.computer > 2 || snapshot.historyLength > SNAPSHOT_HISTORY
+     || snapshot.historyLength > snapshot.plies || (snapshot.pieces[0] & snapshot.pieces[1])
+     || (snapshot.kings & ~(snapshot.pieces[0] | snapshot.pieces[1])))
+    return false;
+
+  memset(pos.grid, 0, sizeof(pos.grid));
+
+  for(int x = 0; x < 8; x++)
+    for(int y = (x + 1) % 2; y < 8; y += 2)
+      {
+	unsigned int bit = 1U << (x * 4 + y / 2);
+
+	if(snapshot.pieces[0] & bit)
+	  pos.grid[x][y] = snapshot.kings & bit ? 3 : 1;
+	else if(snapshot.pieces[1] & bit)
+	  pos.grid[x][y] = snapshot.kings & bit ? 4 : 2;
+      }
+
+  pos.turn = snapshot.turn;
+  pos.p1Pieces = __builtin_popcount(snapshot.pieces[0]);
+  pos.p2Pieces = __builtin_popcount(snapshot.pieces[1]);
+  computer = snapshot.computer;
+  history.plies = snapshot.plies;
+  history.length = snapshot.historyLength;
+  memcpy(history.moves, snapshot.history, history.length * sizeof(history.moves[0]));
+
+  return true;
+}
+
+//The 64 characters of base64, in order.
+const char BASE64_DIGITS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+string snapshotText(const Snapshot &snapshot)
+{
+  const unsigned char *bytes = (const unsigned char *) &snapshot;
+  string text;
+
+  //64 bytes is 21 groups of three and one left over, which
+  //base64 pads out with two ='s.
+  for(size_t i = 0; i < sizeof(snapshot); i += 3)
+    {
+      unsigned int group = bytes[i] << 16;
+
+      if(i + 1 < sizeof(snapshot))
+	group |= bytes[i + 1] << 8 | bytes[i + 2];
+
+      text += BASE64_DIGITS[group >> 18];
+      text += BASE64_DIGITS[group >> 12 & 63];
+      text += i + 1 < sizeof(snapshot) ? BASE64_DIGITS[group >> 6 & 63] : '=';
+      text += i + 1 < sizeof(snapshot) ? BASE64_DIGITS[group & 63] : '=';
+    }
+
+  return text;
+}
+
+bool readSnapshotText(const char *text, Snapshot &snapshot)
+{
+  unsigned char *bytes = (unsigned char *) &snapshot;
+
+  if(strlen(text) != 88 || strcmp(text + 86, "==") != 0)
+    return false;
+
+  for(size_t i = 0; i < sizeof(snapshot); i += 3)
+    {
+      unsigned int group = 0;
+      int digits = i + 1 < sizeof(snapshot) ? 4 : 2;
+
+      for(int d = 0; d < 4; d++)
+	{
+	  const char *digit = strchr(BASE64_DIGITS, *text++);
+
+	  if(d < digits && (digit == NULL || *digit == '\0'))
+	    return false;
+
+	  group = group << 6 | (d < digits ? digit - BASE64_DIGITS : 0);
+	}
+
+      bytes[i] = group >> 16;
+
+      if(i + 1 < sizeof(snapshot))
+	{
+	  bytes[i + 1] = group >> 8;
+	  bytes[i + 2] = group;
+	}
+    }
+
+  return true;
+}
+
+bool writeSnapshotFile(const char *file, const Snapshot &snapshot)
+{
+  ofstream out(file, ios::binary);
+
+  out.write((const char *) &snapshot, sizeof(snapshot));
+  out.close();
+
+  return !out.fail();
+}
+
+bool readSnapshotFile(const char *file, Snapshot &snapshot)
+{
+  ifstream in(file, ios::binary);
+
+  return (bool) in.read((char *) &snapshot, sizeof(snapshot));
+}
+
+void saveGame(const char *file, int grid[][8], int turn, int computer, const GameHistory &history)
+{
+  Position pos;
+  Snapshot snapshot;
+
+  if(file == NULL)
+    return;
+
+  memcpy(pos.grid, grid, sizeof(pos.grid));
+  pos.turn = turn;
+  saveSnapshot(pos, computer, history, snapshot);
+
+  if(writeSnapshotFile(file, snapshot))
+    cout << "\nGame saved to " << file << ".  Use --resume " << file << " to carry on.\n";
+  else
+    cerr << "\nCould not save the game to " << file << endl;
+}
+
+//How many records the journal's queue holds.  A thread that
+//finds it full waits for the writer to catch up.
+const size_t JOURNAL_QUEUE_SIZE = 1 << 16;
+
+//The most records the writer writes out at once.
+const size_t JOURNAL_BATCH = 4096;
+
+//journalChecksum() returns the FNV-1a hash of every byte of
+//record but its checksum.
+unsigned int journalChecksum(const JournalRecord &record)
+{
+  const unsigned char *bytes = (const unsigned char *) &record;
+  unsigned int hash = 2166136261U;
+
+  for(size_t i = sizeof(record.checksum); i < sizeof(record); i++)
+    hash = (hash ^ bytes[i]) * 16777619U;
+
+  return hash;
+}
+
+//startRecord() returns the JournalRecord that starts game,
+//numbered number, from where it stands.
+JournalRecord startRecord(unsigned long long number, const JournalGame &game)
+{
+  JournalRecord record;
+  Snapshot snapshot;
+  unsigned short plies;
+
+  saveSnapshot(game.pos, game.computer, game.history, snapshot);
+  plies = snapshot.plies;
+
+  memset(&record, 0, sizeof(record));
+  record.type = JOURNAL_START;
+  record.game = number;
+  memcpy(record.data, snapshot.pieces, 12);
+  memcpy(record.data + 12, &plies, 2);
+  record.data[14] = snapshot.turn;
+  record.data[15] = snapshot.computer;
+
+  return record;
+}
+
+//applyJournalRecord() brings games, the games in progress, up
+//to date with record.  Returns false if record is malformed.
+bool applyJournalRecord(map<unsigned long long, JournalGame> &games, const JournalRecord &record)
+{
+  if(record.type == JOURNAL_START)
+    {
+      Snapshot snapshot;
+      JournalGame game;
+
+      memset(&snapshot, 0, sizeof(snapshot));
+      memcpy(snapshot.pieces, record.data, 12);
+      memcpy(&snapshot.plies, record.data + 12, 2);
+      snapshot.magic = SNAPSHOT_MAGIC;
+      snapshot.turn = record.data[14];
+      snapshot.computer = record.data[15];
+
+      if(!loadSnapshot(snapshot, game.pos, game.computer, game.history))
+	return false;
+
+      games[record.game] = game;
+    }
+  else if(record.type == JOURNAL_MOVE)
+    {
+      map<unsigned long long, JournalGame>::iterator found = games.find(record.game);
+      Move move;
+
+      if(record.count < 2 || record.count > MAX_MOVE_PATH)
+	return false;
+
+      for(int i = 0; i < record.count; i++)
+	{
+	  int square = record.data[i];
+
+	  if(square >= 32)
+	    return false;
+
+	  move.path[i][0] = square / 4;
+	  move.path[i][1] = square % 4 * 2 + (square / 4 + 1) % 2;
+	}
+
+      move.length = record.count;
+
+      if(found != games.end())
+	{
+	  makeMove(found->second.pos, move);
+	  recordMove(found->second.history, move);
+	}
+    }
+  else if(record.type == JOURNAL_END && record.count <= 2)
+    games.erase(record.game);
+  else
+    return false;
+
+  return true;
+}
+
+//readJournal() reads the journal in file into games, the games
+//it leaves unfinished, and sets lastGame to the highest game
+//number in it, good to the length of the run of intact records
+//it starts with, where reading stops, and end to its length.
+//Only a record that fails its checksum or is cut short is torn;
+//one that is intact but makes no sense, such as a move of
+//squares that are not on the board, is passed over, and
+//counted in skipped.  Returns false if file cannot be read.
+bool readJournal(const char *file, map<unsigned long long, JournalGame> &games, unsigned long long &lastGame, long long &good, long long &end, long long &skipped)
+{
+  ifstream in(file, ios::binary);
+  JournalRecord record;
+
+  if(!in)
+    return false;
+
+  good = 0;
+  skipped = 0;
+
+  while(in.read((char *) &record, sizeof(record)) && record.checksum == journalChecksum(record))
+    {
+      if(!applyJournalRecord(games, record))
+	skipped++;
+
+      good += sizeof(record);
+      lastGame = max(lastGame, record.game);
+    }
+
+  in.clear();
+  in.seekg(0, ios::end);
+  end = in.tellg();
+
+  return true;
+}
+
+//journalPush() hands record to the writer thread.  Each thread
+//claims a ticket, the place in line of its record, by counting
+//up head.  The slot for ticket t has sequence t while it waits
+//for the record, t + 1 once the record is in it, and t +
+//capacity once the writer has taken the record out, when it is
+//free for the next round.  If the writer has found the ring
+//empty and gone idle, the record is woken up for; the sequence
+//is stored before idle is read, and the writer sets idle before
+//it looks at the slot, so that one of them always sees the
+//other.
+void journalPush(JournalRecord &record)
+{
+  unsigned long long ticket = journal->head.fetch_add(1, memory_order_relaxed);
+  JournalSlot &slot = journal->slots[ticket & (journal->capacity - 1)];
+
+  record.checksum = journalChecksum(record);
+
+  while(slot.sequence.load(memory_order_acquire) != ticket)
+    this_thread::yield();
+
+  slot.record = record;
+  slot.sequence.store(ticket + 1);
+
+  if(journal->idle.load())
+    {
+      lock_guard<mutex> guard(journal->lock);
+      journal->work.notify_one();
+    }
+}
+
+#ifdef __linux__
+//journalFailed() reports that the journal cannot be written to,
+//the first time it happens, and stops writing it.
+void journalFailed(const char *what)
+{
+  if(!journal->failed)
+    cerr << "Could not " << what << " the journal " << journal->file << ": " << strerror(errno)
+	 << ".  Games are no longer journaled." << endl;
+
+  journal->failed = true;
+}
+
+//writeJournal() appends count records to the journal file and
+//syncs it: one commit, however many games the records are from.
+void writeJournal(const JournalRecord *records, size_t count)
+{
+  const char *bytes = (const char *) records;
+  size_t left = count * sizeof(JournalRecord);
+
+  while(left > 0 && !journal->failed)
+    {
+      ssize_t written = write(journal->fd, bytes, left);
+
+      if(written < 0 && errno == EINTR)
+	continue;
+      if(written < 0)
+	journalFailed("write to");
+      else
+	{
+	  bytes += written;
+	  left -= written;
+	  journal->bytes += written;
+	}
+    }
+
+  if(!journal->failed && fdatasync(journal->fd) != 0)
+    journalFailed("sync");
+
+  journal->records.fetch_add(count, memory_order_relaxed);
+  journal->commits.fetch_add(1, memory_order_relaxed);
+}
+
+//rotateJournal() moves the journal file aside, to
+//file.rotation, and carries on in a new one that starts every
+//game in progress from where it stands, so that it can be
+//recovered from on its own.  The new file is written in full
+//before it replaces the old one, so that whenever the program
+//stops, file holds every game.
+void rotateJournal()
+{
+  string file = journal->file, rotated = file + "." + to_string(journal->rotation), fresh = file + ".new";
+  string directory = file.find('/') == string::npos ? "." : file.substr(0, file.rfind('/') + 1);
+  vector<JournalRecord> starts;
+  int fd = open(fresh.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+  int old = journal->fd;
+
+  if(fd < 0 || link(file.c_str(), rotated.c_str()) != 0)
+    {
+      cerr << "Could not rotate the journal " << file << ": " << strerror(errno) << endl;
+      journal->rotateBytes = (size_t) -1;
+
+      if(fd >= 0)
+	close(fd);
+
+      return;
+    }
+
+  for(map<unsigned long long, JournalGame>::iterator i = journal->games.begin(); i != journal->games.end(); ++i)
+    {
+      starts.push_back(startRecord(i->first, i->second));
+      starts.back().checksum = journalChecksum(starts.back());
+    }
+
+  journal->fd = fd;
+  journal->bytes = 0;
+  journal->rotation++;
+  writeJournal(starts.data(), starts.size());
+
+  if(rename(fresh.c_str(), file.c_str()) != 0)
+    journalFailed("rotate");
+
+  close(old);
+
+  //The renaming is only safe once the directory is synced.
+  fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+  if(fd >= 0)
+    {
+      fsync(fd);
+      close(fd);
+    }
+}
+
+//journalWriter() is the journal's writer thread.  It takes
+//whatever records have been queued, up to JOURNAL_BATCH of
+//them, and commits them with one write and one sync, so that
+//the more games are being played the more moves each sync
+//covers, and waits for more when there are none.  Once
+//stopping is set, it returns when it has written out
+//everything queued before.  Signals are left to
+//the program's other threads, so that --serve's signalfd
+//gets them.
+void journalWriter()
+{
+  vector<JournalRecord> batch;
+  sigset_t signals;
+
+  sigfillset(&signals);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+  batch.reserve(JOURNAL_BATCH);
+
+  while(true)
+    {
+      bool stopping = journal->stopping.load();
+
+      while(batch.size() < JOURNAL_BATCH)
+	{
+	  JournalSlot &slot = journal->slots[journal->tail & (journal->capacity - 1)];
+
+	  if(slot.sequence.load(memory_order_acquire) != journal->tail + 1)
+	    break;
+
+	  batch.push_back(slot.record);
+	  slot.sequence.store(journal->tail + journal->capacity, memory_order_release);
+	  journal->tail++;
+	}
+
+      if(batch.empty())
+	{
+	  JournalSlot &next = journal->slots[journal->tail & (journal->capacity - 1)];
+	  unique_lock<mutex> guard(journal->lock);
+
+	  if(stopping)
+	    return;
+
+	  journal->idle = true;
+
+	  while(!journal->stopping && next.sequence.load() != journal->tail + 1)
+	    journal->work.wait(guard);
+
+	  journal->idle = false;
+	  continue;
+	}
+
+      writeJournal(batch.data(), batch.size());
+
+      for(size_t i = 0; i < batch.size(); i++)
+	applyJournalRecord(journal->games, batch[i]);
+
+      if(journal->bytes >= journal->rotateBytes && !journal->failed)
+	rotateJournal();
+
+      batch.clear();
+    }
+}
+
+bool openJournal(const char *file, size_t rotateBytes)
+{
+  unsigned long long lastGame = 0;
+  long long good = 0, end = 0, skipped = 0;
+  long long now = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count();
+
+  journal = new Journal();
+  journal->file = file;
+  journal->rotateBytes = rotateBytes;
+
+  if(readJournal(file, journal->games, lastGame, good, end, skipped))
+    {
+      if(good < end)
+	{
+	  if(truncate(file, good) != 0)
+	    {
+	      cerr << "Could not repair the journal " << file << ": " << strerror(errno) << endl;
+	      journal = NULL;
+	      return false;
+	    }
+
+	  cerr << "Cut " << end - good << " bytes of torn records off the end of the journal " << file << endl;
+	}
+
+      if(skipped > 0)
+	cerr << "Skipped " << skipped << " malformed records in the journal " << file << endl;
+
+      if(!journal->games.empty())
+	cerr << journal->games.size() << " games were left unfinished in the journal " << file
+	     << ".  --recover " << file << " lists them." << endl;
+    }
+
+  //The games an earlier run left unfinished stay in games, so
+  //that rotating the file starts them afresh in the new one
+  //like the games in progress, and --recover still finds them.
+  //Games are numbered from the time in microseconds, times
+  //1024, so that runs never reuse each other's numbers.
+  journal->nextGame = max(lastGame + 1, (unsigned long long) now << 10);
+  journal->fd = open(file, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  journal->bytes = good;
+
+  if(journal->fd < 0)
+    {
+      cerr << "Could not open the journal " << file << ": " << strerror(errno) << endl;
+      journal = NULL;
+      return false;
+    }
+
+  journal->rotation = 1;
+
+  while(access((journal->file + "." + to_string(journal->rotation)).c_str(), F_OK) == 0)
+    journal->rotation++;
+
+  journal->capacity = JOURNAL_QUEUE_SIZE;
+  journal->slots = (JournalSlot *) allocateBlock(journal->capacity * sizeof(JournalSlot), "journal queue");
+
+  for(size_t i = 0; i < journal->capacity; i++)
+    journal->slots[i].sequence.store(i, memory_order_relaxed);
+
+  journal->writer = thread(journalWriter);
+  atexit(closeJournal);
+
+  return true;
+}
+
+void closeJournal()
+{
+  if(journal == NULL)
+    return;
+
+  {
+    lock_guard<mutex> guard(journal->lock);
+    journal->stopping = true;
+  }
+
+  journal->work.notify_one();
+  journal->writer.join();
+  close(journal->fd);
+  journal = NULL;
+}
+#else
+bool openJournal(const char *file, size_t rotateBytes)
+{
+  cerr << "--journal is only available on Linux" << endl;
+  return false;
+}
+
+void closeJournal()
+{
+}
+#endif
+
+unsigned long long journalStart(const Position &pos, int computer, int plies)
+{
+  JournalGame game;
+  JournalRecord record;
+  unsigned long long number;
+
+  if(journal == NULL)
+    return 0;
+
+  number = journal->nextGame++;
+  game.pos = pos;
+  game.computer = computer;
+  game.history.plies = plies;
+  game.history.length = 0;
+  record = startRecord(number, game);
+  journalPush(record);
+
+  return number;
+}
+
+void journalMove(unsigned long long game, const Move &move)
+{
+  JournalRecord record;
+
+  if(journal == NULL || game == 0)
+    return;
+
+  memset(&record, 0, sizeof(record));
+  record.type = JOURNAL_MOVE;
+  record.count = move.length;
+  record.game = game;
+
+  for(int i = 0; i < move.length; i++)
+    record.data[i] = move.path[i][0] * 4 + move.path[i][1] / 2;
+
+  journalPush(record);
+}
+
+void journalEnd(unsigned long long game, int winner)
+{
+  JournalRecord record;
+
+  if(journal == NULL || game == 0)
+    return;
+
+  memset(&record, 0, sizeof(record));
+  record.type = JOURNAL_END;
+  record.count = winner;
+  record.game = game;
+  journalPush(record);
+}
+
+bool runRecovery(const char *file)
+{
+  map<unsigned long long, JournalGame> games;
+  unsigned long long lastGame = 0;
+  long long good = 0, end = 0, skipped = 0;
+
+  if(!readJournal(file, games, lastGame, good, end, skipped))
+    {
+      cerr << "Could not read the journal " << file << endl;
+      return false;
+    }
+
+  for(map<unsigned long long, JournalGame>::iterator i = games.begin(); i != games.end(); ++i)
+    {
+      Snapshot snapshot;
+
+      saveSnapshot(i->second.pos, i->second.computer, i->second.history, snapshot);
+      cout << i->first << " " << positionText(i->second.pos.grid, i->second.pos.turn)
+	   << " " << snapshotText(snapshot) << "\n";
+    }
+
+  cerr << games.size() << " unfinished games in " << file;
+
+  if(skipped > 0)
+    cerr << ", " << skipped << " malformed records skipped";
+
+  if(good < end)
+    cerr << ", followed by " << end - good << " bytes of torn records";
+
+  cerr << endl;
+
+  return true;
+}
+
+bool checkMove(Position &pos, const Move &move)
+{
+  int xFrom = move.path[0][0], yFrom = move.path[0][1];
+
+  if(pos.grid[xFrom][yFrom] != pos.turn && pos.grid[xFrom][yFrom] != pos.turn + 2)
+    return false;
+
+  if(!applyStep(pos, xFrom, yFrom, move.path[1][0], move.path[1][1]))
+    return false;
+
+  //Only a jump can go on.
+  if(move.length > 2 && abs(move.path[1][0] - xFrom) != 2)
+    return false;
+
+  for(int i = 2; i < move.length; i++)
+    {
+      int x = move.path[i - 1][0], y = move.path[i - 1][1];
+      int jumpReg[4][2];
+      bool legal = false;
+
+      if(!isDoubleJumpAvailable(x, y, pos.turn, pos.grid, jumpReg))
+	return false;
+
+      for(int j = 0; j < 4; j++)
+	if(jumpReg[j][0] == move.path[i][0] && jumpReg[j][1] == move.path[i][1])
+	  legal = true;
+
+      if(!legal || !applyStep(pos, x, y, move.path[i][0], move.path[i][1]))
+	return false;
+    }
+
+  pos.turn = pos.turn == 1 ? 2 : 1;
+
+  return true;
+}
+
+void toBitboard(const Position &pos, Bitboard &board)
+{
+  board.pieces[0] = 0;
+  board.pieces[1] = 0;
+  board.kings = 0;
+  board.turn = pos.turn;
+
+  for(int x = 0; x < 8; x++)
+    for(int y = 0; y < 8; y++)
+      {
+	unsigned long long bit = 1ULL << (x * 8 + y);
+
+	switch(pos.grid[x][y])
+	  {
+	  case 1: board.pieces[0] |= bit; break;
+	  case 2: board.pieces[1] |= bit; break;
+	  case 3: board.pieces[0] |= bit; board.kings |= bit; break;
+	  case 4: board.pieces[1] |= bit; board.kings |= bit; break;
+	  }
+      }
+}
+
+void fromBitboard(const Bitboard &board, Position &pos)
+{
+  pos.turn = board.turn;
+  pos.p1Pieces = __builtin_popcountll(board.pieces[0]);
+  pos.p2Pieces = __builtin_popcountll(board.pieces[1]);
+
+  for(int x = 0; x < 8; x++)
+    for(int y = 0; y < 8; y++)
+      {
+	unsigned long long bit = 1ULL << (x * 8 + y);
+
+	if(board.pieces[0] & bit)
+	  pos.grid[x][y] = board.kings & bit ? 3 : 1;
+	else if(board.pieces[1] & bit)
+	  pos.grid[x][y] = board.kings & bit ? 4 : 2;
+	else
+	  pos.grid[x][y] = 0;
+      }
+}
+
+BitMove toBitMove(const Move &move)
+{
+  BitMove bitMove;
+
+  bitMove.from = 1ULL << (move.path[0][0] * 8 + move.path[0][1]);
+  bitMove.to = 1ULL << (move.path[move.length - 1][0] * 8 + move.path[move.length - 1][1]);
+  bitMove.captured = 0;
+
+  //Each jump captures the piece halfway between the two
+  //squares; a plain move lands next door and captures
+  //nothing.
+  for(int i = 1; i < move.length; i++)
+    {
+      int dx = move.path[i][0] - move.path[i - 1][0];
+      int dy = move.path[i][1] - move.path[i - 1][1];
+
+      if(dx == 2 || dx == -2)
+	bitMove.captured |= 1ULL << ((move.path[i - 1][0] + dx / 2) * 8 + move.path[i - 1][1] + dy / 2);
+    }
+
+  return bitMove;
+}
+
+//The rows on which each player's pieces are crowned.
+const unsigned long long CROWN_ROW[2] = { 0xFF00000000000000ULL, 0x00000000000000FFULL };
+
+void flipBitboard(Bitboard &board)
+{
+  unsigned long long masks[3] = { board.pieces[1], board.pieces[0], board.kings };
+
+  //Turning the board round is reversing the order of the 64
+  //bits: the bytes (the rows), then the bits within each byte.
+  for(int i = 0; i < 3; i++)
+    {
+      unsigned long long mask = __builtin_bswap64(masks[i]);
+
+      mask = (mask >> 1 & 0x5555555555555555ULL) | (mask & 0x5555555555555555ULL) << 1;
+      mask = (mask >> 2 & 0x3333333333333333ULL) | (mask & 0x3333333333333333ULL) << 2;
+      mask = (mask >> 4 & 0x0F0F0F0F0F0F0F0FULL) | (mask & 0x0F0F0F0F0F0F0F0FULL) << 4;
+      masks[i] = mask;
+    }
+
+  board.pieces[0] = masks[0];
+  board.pieces[1] = masks[1];
+  board.kings = masks[2];
+  board.turn = board.turn == 1 ? 2 : 1;
+}
+
+bool canonicalize(Bitboard &board)
+{
+  if(board.turn == 1)
+    return false;
+
+  flipBitboard(board);
+  return true;
+}
+
+void applyBitMove(Bitboard &board, const BitMove &move)
+{
+  int side = board.turn - 1;
+  bool king = (board.kings & move.from) != 0;
+
+  //Clear the square left before setting the one landed on,
+  //since a King can jump all the way round and land where
+  //it started.
+  board.pieces[side] &= ~move.from;
+  board.pieces[side] |= move.to;
+  board.pieces[1 - side] &= ~move.captured;
+  board.kings &= ~(move.from | move.captured);
+
+  if(king || (move.to & CROWN_ROW[side]))
+    board.kings |= move.to;
+
+  board.turn = board.turn == 1 ? 2 : 1;
+}
+
+//The four diagonal directions as shifts of a Bitboard mask:
+//down-right, down-left, up-right and up-left (down being
+//towards row 8).  Player 1's standard pieces use the first
+//two, player 2's the last two, and Kings all four.
+const int BIT_DIRECTIONS[4] = { 9, 7, -7, -9 };
+
+//Masks of the squares a piece can step (or jump) from in each
+//direction without running off the side of the board.  Running
+//off the top or bottom takes care of itself, since those bits
+//are shifted out of the mask.
+const unsigned long long COLUMN_0 = 0x0101010101010101ULL;
+const unsigned long long STEP_FROM[4] = { ~(COLUMN_0 << 7), ~COLUMN_0, ~(COLUMN_0 << 7), ~COLUMN_0 };
+const unsigned long long JUMP_FROM[4] = { ~(COLUMN_0 << 7 | COLUMN_0 << 6), ~(COLUMN_0 | COLUMN_0 << 1),
+					  ~(COLUMN_0 << 7 | COLUMN_0 << 6), ~(COLUMN_0 | COLUMN_0 << 1) };
+
+unsigned long long shiftMask(unsigned long long mask, int shift)
+{
+  return shift > 0 ? mask << shift : mask >> -shift;
+}
+
+//movers() gives the pieces of side (0 or 1) among pieces that
+//may move in direction d.
+unsigned long long movers(const Bitboard &board, unsigned long long pieces, int side, int d)
+{
+  bool forward = side == 0 ? d < 2 : d >= 2;
+
+  return forward ? pieces : pieces & board.kings;
+}
+
+//jumpTargets() gives, for direction d, the landing squares of
+//every jump the pieces in from can make.
+unsigned long long jumpTargets(const Bitboard &board, unsigned long long from, int d)
+{
+  int side = board.turn - 1;
+  unsigned long long empty = ~(board.pieces[0] | board.pieces[1]);
+  unsigned long long over = shiftMask(movers(board, from, side, d) & JUMP_FROM[d], BIT_DIRECTIONS[d]) & board.pieces[1 - side];
+
+  return shiftMask(over, BIT_DIRECTIONS[d]) & empty;
+}
+
+//pickBit() returns the index of the n-th set bit of mask,
+//counting from 0.
+int pickBit(unsigned long long mask, int n)
+{
+  for(; n > 0; n--)
+    mask &= mask - 1;
+
+  return __builtin_ctzll(mask);
+}
+
+//Playouts still going after this many plies are scored on
+//material: a lead of at least this many pieces (Kings count
+//double) wins, anything less is a draw.
+const int PLAYOUT_MAX_PLIES = 150;
+const int PLAYOUT_WINNING_LEAD = 3;
+
+int playout(Bitboard board, unsigned long long &random)
+{
+  STAT_COUNT(COUNT_PLAYOUTS);
+
+  for(int ply = 0; ply < PLAYOUT_MAX_PLIES; ply++)
+    {
+      int side = board.turn - 1;
+      unsigned long long mine = board.pieces[side];
+      unsigned long long empty = ~(board.pieces[0] | board.pieces[1]);
+      unsigned long long steps[4], jumps[4];
+      int stepCount = 0, jumpCount = 0;
+
+      for(int d = 0; d < 4; d++)
+	{
+	  steps[d] = shiftMask(movers(board, mine, side, d) & STEP_FROM[d], BIT_DIRECTIONS[d]) & empty;
+	  jumps[d] = jumpTargets(board, mine, d);
+	  stepCount += __builtin_popcountll(steps[d]);
+	  jumpCount += __builtin_popcountll(jumps[d]);
+	}
+
+      //No pieces, or none that can move, loses.
+      if(stepCount + jumpCount == 0)
+	return board.turn == 1 ? 2 : 1;
+
+      //Jump three times out of four when there is a jump
+      //to make.
+      bool jump = jumpCount > 0 && (stepCount == 0 || nextRandom(random) % 4 != 0);
+      unsigned long long *targets = jump ? jumps : steps;
+      int n = nextRandom(random) % (jump ? jumpCount : stepCount);
+      int d = 0;
+
+      while(n >= __builtin_popcountll(targets[d]))
+	n -= __builtin_popcountll(targets[d++]);
+
+      BitMove move;
+
+      move.to = 1ULL << pickBit(targets[d], n);
+      move.from = shiftMask(move.to, -BIT_DIRECTIONS[d] * (jump ? 2 : 1));
+      move.captured = jump ? shiftMask(move.to, -BIT_DIRECTIONS[d]) : 0;
+
+      //Keep jumping with the same piece, in a random
+      //direction, for as long as it can.  The piece is
+      //crowned as soon as it lands on the far row, so look
+      //at a copy of the board with the jumps so far made.
+      while(jump)
+	{
+	  Bitboard after = board;
+	  after.pieces[side] = (after.pieces[side] & ~move.from) | move.to;
+	  after.pieces[1 - side] &= ~move.captured;
+	  after.kings &= ~(move.from | move.captured);
+	  if((board.kings & move.from) || (move.to & CROWN_ROW[side]))
+	    after.kings |= move.to;
+
+	  unsigned long long next[4];
+	  int count = 0;
+
+	  for(int k = 0; k < 4; k++)
+	    {
+	      next[k] = jumpTargets(after, move.to, k);
+	      count += __builtin_popcountll(next[k]);
+	    }
+
+	  if(count == 0)
+	    break;
+
+	  n = nextRandom(random) % count;
+	  for(d = 0; n >= __builtin_popcountll(next[d]); d++)
+	    n -= __builtin_popcountll(next[d]);
+
+	  move.captured |= shiftMask(move.to, BIT_DIRECTIONS[d]);
+	  move.to = shiftMask(move.to, 2 * BIT_DIRECTIONS[d]);
+	}
+
+      applyBitMove(board, move);
+    }
+
+  int lead = __builtin_popcountll(board.pieces[0]) + __builtin_popcountll(board.pieces[0] & board.kings)
+    - __builtin_popcountll(board.pieces[1]) - __builtin_popcountll(board.pieces[1] & board.kings);
+
+  if(lead >= PLAYOUT_WINNING_LEAD)
+    return 1;
+  if(lead <= -PLAYOUT_WINNING_LEAD)
+    return 2;
+  return 0;
+}
+
+//The exploration constant of the UCT formula.
+const double MCTS_EXPLORATION = 0.7;
+
+//expandMctsNode() gives node its children, one for each move
+//generateMoves() finds in pos, taken from the engine's pool.
+//If the pool has run out, node is left a leaf, and is played
+//out from instead, for the rest of the move.
+void expandMctsNode(Engine &engine, MctsNode &node, Position &pos)
+{
+  Move moves[MAX_MOVES];
+  int count = generateMoves(pos, moves, false);
+  long long first = engine.treeTop.fetch_add(count);
+
+  if(first + count > engine.config.treeNodes)
+    {
+      node.state.store(3, memory_order_release);
+      return;
+    }
+
+  for(int i = 0; i < count; i++)
+    {
+      MctsNode &child = engine.tree[first + i];
+
+      child.visits.store(0, memory_order_relaxed);
+      child.score.store(0, memory_order_relaxed);
+      child.state.store(0, memory_order_relaxed);
+      child.firstChild = 0;
+      child.childCount = 0;
+      child.move = toBitMove(moves[i]);
+    }
+
+  node.firstChild = first;
+  node.childCount = count;
+  node.state.store(2, memory_order_release);
+}
+
+//mctsIteration() runs one iteration of the search from the root:
+//down the tree by UCT, expanding the leaf it reaches, a playout,
+//and the result back up.  Every node on the way down gets its
+//visit straight away, with no score, as a virtual loss, so that
+//other threads are steered towards other parts of the tree
+//until the result comes back.
+void mctsIteration(Engine &engine, const Bitboard &root, unsigned long long &random)
+{
+  MctsNode *path[MAX_MOVES * 2];
+  int depth = 0;
+  Bitboard board = root;
+  MctsNode *node = &engine.tree[0];
+
+  node->visits.fetch_add(1, memory_order_relaxed);
+  path[depth++] = node;
+
+  while(node->state.load(memory_order_acquire) == 2 && node->childCount > 0 && depth < MAX_MOVES * 2)
+    {
+      double logVisits = log((double) node->visits.load(memory_order_relaxed));
+      double bestValue = -1;
+      MctsNode *best = NULL;
+
+      for(int i = 0; i < node->childCount; i++)
+	{
+	  MctsNode &child = engine.tree[node->firstChild + i];
+	  int visits = child.visits.load(memory_order_relaxed);
+
+	  //Unvisited children go first.
+	  double value = visits == 0 ? 1e9 + i : child.score.load(memory_order_relaxed) / (2.0 * visits) + MCTS_EXPLORATION * sqrt(logVisits / visits);
+
+	  if(value > bestValue)
+	    {
+	      bestValue = value;
+	      best = &child;
+	    }
+	}
+
+      node = best;
+      node->visits.fetch_add(1, memory_order_relaxed);
+      path[depth++] = node;
+      applyBitMove(board, node->move);
+    }
+
+  int winner;
+  int expected = 0;
+
+  //An expanded node with no children is the end of the game:
+  //the side to move there has lost.
+  if(node->state.load(memory_order_acquire) == 2 && node->childCount == 0)
+    winner = board.turn == 1 ? 2 : 1;
+  else
+    {
+      //Only one thread expands a node; the others just play
+      //out from it in the meantime.
+      if(node->state.compare_exchange_strong(expected, 1))
+	{
+	  Position pos;
+	  fromBitboard(board, pos);
+	  expandMctsNode(engine, *node, pos);
+	}
+
+      winner = playout(board, random);
+    }
+
+  //Credit each node for the player who moved into it: the
+  //side not to move in it.
+  for(int i = depth - 1; i >= 0; i--)
+    {
+      int mover = board.turn == 1 ? 2 : 1;
+
+      if(winner == 0)
+	path[i]->score.fetch_add(1, memory_order_relaxed);
+      else if(winner == mover)
+	path[i]->score.fetch_add(2, memory_order_relaxed);
+
+      board.turn = mover;
+    }
+}
+
+//One search thread: run iterations until the playouts or the
+//time run out.
+void mctsWorker(Engine &engine, const Bitboard &root, atomic<long long> &iterations, unsigned long long seed)
+{
+  TRACE_SCOPE("mcts thread");
+
+  typedef chrono::steady_clock clock;
+  clock::time_point deadline = clock::now() + chrono::milliseconds(engine.config.moveTime);
+  long long limit = engine.config.playouts > 0 ? engine.config.playouts : 10000;
+  unsigned long long random = seed;
+
+  while(true)
+    {
+      long long done = iterations.fetch_add(1, memory_order_relaxed);
+
+      //Only a single-threaded search is polled, so that poll
+      //is never called from two threads at once.
+      if(engine.poll && engine.config.threads == 1 && done % 64 == 0)
+	{
+	  engine.nodes = done;
+	  engine.poll(engine);
+
+	  if(engine.moveNow)
+	    break;
+	}
+
+      if(engine.config.moveTime > 0)
+	{
+	  if(done % 64 == 0 && clock::now() >= deadline)
+	    break;
+	}
+      else if(done >= limit)
+	break;
+
+      mctsIteration(engine, root, random);
+    }
+}
+
+//Seeds for the search threads' random number generators.
+atomic<unsigned long long> mctsSeeds(0x853C49E6748FEA9BULL);
+
+//One of an MCTS player's pool threads: search each move's
+//board as it is handed out, until the pool is stopped.
+void mctsPoolThread(MctsPool &pool)
+{
+  unique_lock<mutex> guard(pool.lock);
+  long long seen = 0;
+
+  while(true)
+    {
+      while(pool.generation == seen && !pool.stopping)
+	pool.start.wait(guard);
+
+      if(pool.stopping)
+	return;
+
+      seen = pool.generation;
+      guard.unlock();
+      mctsWorker(*pool.engine, pool.board, pool.iterations, mctsSeeds.fetch_add(0x9E3779B97F4A7C15ULL) | 1);
+      guard.lock();
+
+      if(--pool.running == 0)
+	pool.finished.notify_all();
+    }
+}
+
+MctsPool::~MctsPool()
+{
+  {
+    lock_guard<mutex> guard(lock);
+    stopping = true;
+  }
+
+  start.notify_all();
+
+  for(size_t i = 0; i < threads.size(); i++)
+    threads[i].join();
+}
+
+//runMctsPool() searches board with the calling thread and
+//engine's pool threads, starting them if this is the first
+//move, and returns how many iterations they ran between them.
+long long runMctsPool(Engine &engine, const Bitboard &board)
+{
+  if(!engine.pool)
+    {
+      engine.pool.reset(new MctsPool);
+
+      MctsPool &pool = *engine.pool;
+
+      pool.engine = &engine;
+      pool.generation = 0;
+      pool.running = 0;
+      pool.stopping = false;
+
+      for(int i = 1; i < engine.config.threads; i++)
+	pool.threads.push_back(thread(mctsPoolThread, ref(pool)));
+    }
+
+  MctsPool &pool = *engine.pool;
+
+  {
+    lock_guard<mutex> guard(pool.lock);
+    pool.board = board;
+    pool.iterations = 0;
+    pool.running = pool.threads.size();
+    pool.generation++;
+  }
+
+  pool.start.notify_all();
+  mctsWorker(engine, pool.board, pool.iterations, mctsSeeds.fetch_add(0x9E3779B97F4A7C15ULL) | 1);
+
+  unique_lock<mutex> guard(pool.lock);
+
+  while(pool.running > 0)
+    pool.finished.wait(guard);
+
+  return pool.iterations;
+}
+
+int mctsThink(Engine &engine, Position &pos, Move &best)
+{
+  Move moves[MAX_MOVES];
+  int count = generateMoves(pos, moves, false);
+
+  best.length = 0;
+
+  if(count == 0)
+    return -WIN_SCORE;
+
+  //Start again from an empty tree in the same pool.
+  MctsNode &root = engine.tree[0];
+
+  root.visits.store(0);
+  root.score.store(0);
+  root.state.store(1);
+  engine.treeTop = 1;
+  expandMctsNode(engine, root, pos);
+
+  Bitboard board;
+  long long iterations;
+
+  toBitboard(pos, board);
+
+  //A single-threaded search runs on the calling thread alone.
+  if(engine.config.threads == 1)
+    {
+      atomic<long long> done(0);
+
+      mctsWorker(engine, board, done, mctsSeeds.fetch_add(0x9E3779B97F4A7C15ULL) | 1);
+      iterations = done;
+    }
+  else
+    iterations = runMctsPool(engine, board);
+
+  //The root's children were made from moves, in order, so
+  //the most visited child's index is its move's index.
+  int bestIndex = 0;
+
+  for(int i = 1; i < root.childCount; i++)
+    {
+      if(engine.tree[root.firstChild + i].visits > engine.tree[root.firstChild + bestIndex].visits)
+	bestIndex = i;
+    }
+
+  MctsNode &chosen = engine.tree[root.firstChild + bestIndex];
+  double winRate = chosen.visits > 0 ? chosen.score / (2.0 * chosen.visits) : 0.5;
+
+  best = moves[bestIndex];
+  engine.nodes = iterations;
+
+  //Turn the win rate into something on the same scale as the
+  //alpha-beta scores: 1000 for a sure win, -1000 for a sure
+  //loss.
+  return int((winRate - 0.5) * 2000);
+}
+
+//Batch games still going after this many plies (each jump of a
+//double jump counts as one) are drawn.
+const int BATCH_MAX_PLIES = 300;
+
+//A batch has 16 arrays of masks and 5 of counters.  Each
+//array is rounded up to whole cache lines, so that every one
+//of them starts on a cache line of its own.
+const int BATCH_MASK_ARRAYS = 16;
+const int BATCH_COUNTER_ARRAYS = 5;
+
+size_t batchArrayBytes(int capacity, size_t elementBytes)
+{
+  return (capacity * elementBytes + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT;
+}
+
+size_t batchBytes(int capacity)
+{
+  return BATCH_MASK_ARRAYS * batchArrayBytes(capacity, sizeof(unsigned long long))
+    + BATCH_COUNTER_ARRAYS * batchArrayBytes(capacity, sizeof(int));
+}
+
+void allocateBatch(GameBatch &batch, int capacity)
+{
+  char *block = (char *) allocateBlock(batchBytes(capacity), "batch arrays");
+  unsigned long long **masks[BATCH_MASK_ARRAYS] =
+    {
+      &batch.pieces1, &batch.pieces2, &batch.kings, &batch.pending, &batch.random,
+      &batch.steps[0], &batch.steps[1], &batch.steps[2], &batch.steps[3],
+      &batch.jumps[0], &batch.jumps[1], &batch.jumps[2], &batch.jumps[3],
+      &batch.moveFrom, &batch.moveTo, &batch.moveCaptured
+    };
+  int **counters[BATCH_COUNTER_ARRAYS] = { &batch.turn, &batch.p1Pieces, &batch.p2Pieces, &batch.plies, &batch.result };
+
+  for(int i = 0; i < BATCH_MASK_ARRAYS; i++)
+    {
+      *masks[i] = (unsigned long long *) block;
+      block += batchArrayBytes(capacity, sizeof(unsigned long long));
+    }
+
+  for(int i = 0; i < BATCH_COUNTER_ARRAYS; i++)
+    {
+      *counters[i] = (int *) block;
+      block += batchArrayBytes(capacity, sizeof(int));
+    }
+
+  batch.size = 0;
+  batch.capacity = capacity;
+}
+
+void initBatch(GameBatch &batch, int size, unsigned long long seed)
+{
+  Position start;
+  Bitboard board;
+
+  startPosition(start);
+  toBitboard(start, board);
+
+  batch.size = size;
+  fill_n(batch.pieces1, size, board.pieces[0]);
+  fill_n(batch.pieces2, size, board.pieces[1]);
+  fill_n(batch.kings, size, 0);
+  fill_n(batch.pending, size, 0);
+  fill_n(batch.turn, size, 1);
+  fill_n(batch.p1Pieces, size, 12);
+  fill_n(batch.p2Pieces, size, 12);
+  fill_n(batch.plies, size, 0);
+  fill_n(batch.result, size, 0);
+
+  for(int i = 0; i < size; i++)
+    batch.random[i] = nextRandom(seed) | 1;
+
+  for(int d = 0; d < 4; d++)
+    {
+      fill_n(batch.steps[d], size, 0);
+      fill_n(batch.jumps[d], size, 0);
+    }
+
+  fill_n(batch.moveFrom, size, 0);
+  fill_n(batch.moveTo, size, 0);
+  fill_n(batch.moveCaptured, size, 0);
+}
+
+//select() gives a where mask is all ones and b where it is
+//all zeros, without a branch.
+inline unsigned long long select(unsigned long long mask, unsigned long long a, unsigned long long b)
+{
+  return (a & mask) | (b & ~mask);
+}
+
+//allOnes() turns a condition into a mask of all ones (true)
+//or all zeros (false).
+inline unsigned long long allOnes(bool condition)
+{
+  return 0 - (unsigned long long) condition;
+}
+
+void batchGenerateMoves(GameBatch &batch)
+{
+  const unsigned long long *pieces1 = &batch.pieces1[0], *pieces2 = &batch.pieces2[0];
+  const unsigned long long *kings = &batch.kings[0], *pending = &batch.pending[0];
+  const int *turn = &batch.turn[0], *result = &batch.result[0];
+  unsigned long long *steps[4], *jumps[4];
+
+  for(int d = 0; d < 4; d++)
+    {
+      steps[d] = &batch.steps[d][0];
+      jumps[d] = &batch.jumps[d][0];
+    }
+
+  for(int i = 0; i < batch.size; i++)
+    {
+      unsigned long long isP1 = allOnes(turn[i] == 1);
+      unsigned long long jumping = allOnes(pending[i] != 0);
+      unsigned long long empty = ~(pieces1[i] | pieces2[i]);
+      unsigned long long theirs = select(isP1, pieces2[i], pieces1[i]);
+      unsigned long long mine = select(isP1, pieces1[i], pieces2[i]) & allOnes(result[i] == 0);
+
+      //In the middle of a double jump only the jumping
+      //piece may move, and only by jumping again.
+      mine = select(jumping, pending[i], mine);
+
+      //Player 1's pieces move down the board and player
+      //2's up; Kings go both ways.
+      unsigned long long down = select(isP1, mine, mine & kings[i]);
+      unsigned long long up = select(isP1, mine & kings[i], mine);
+
+      steps[0][i] = ((down & STEP_FROM[0]) << 9) & empty & ~jumping;
+      steps[1][i] = ((down & STEP_FROM[1]) << 7) & empty & ~jumping;
+      steps[2][i] = ((up & STEP_FROM[2]) >> 7) & empty & ~jumping;
+      steps[3][i] = ((up & STEP_FROM[3]) >> 9) & empty & ~jumping;
+
+      jumps[0][i] = ((((down & JUMP_FROM[0]) << 9) & theirs) << 9) & empty;
+      jumps[1][i] = ((((down & JUMP_FROM[1]) << 7) & theirs) << 7) & empty;
+      jumps[2][i] = ((((up & JUMP_FROM[2]) >> 7) & theirs) >> 7) & empty;
+      jumps[3][i] = ((((up & JUMP_FROM[3]) >> 9) & theirs) >> 9) & empty;
+    }
+}
+
+void batchChooseMoves(GameBatch &batch)
+{
+  for(int i = 0; i < batch.size; i++)
+    {
+      batch.moveFrom[i] = 0;
+      batch.moveTo[i] = 0;
+      batch.moveCaptured[i] = 0;
+
+      if(batch.result[i] != 0)
+	continue;
+
+      int stepCount = 0, jumpCount = 0;
+
+      for(int d = 0; d < 4; d++)
+	{
+	  stepCount += __builtin_popcountll(batch.steps[d][i]);
+	  jumpCount += __builtin_popcountll(batch.jumps[d][i]);
+	}
+
+      //No pieces, or none that can move, loses.
+      if(stepCount + jumpCount == 0)
+	{
+	  batch.result[i] = batch.turn[i] == 1 ? 2 : 1;
+	  continue;
+	}
+
+      //As in playout(), jump three times out of four when
+      //there is a jump to make.
+      bool jump = jumpCount > 0 && (stepCount == 0 || nextRandom(batch.random[i]) % 4 != 0);
+      int n = nextRandom(batch.random[i]) % (jump ? jumpCount : stepCount);
+      int d = 0;
+
+      while(n >= __builtin_popcountll(jump ? batch.jumps[d][i] : batch.steps[d][i]))
+	{
+	  n -= __builtin_popcountll(jump ? batch.jumps[d][i] : batch.steps[d][i]);
+	  d++;
+	}
+
+      batch.moveTo[i] = 1ULL << pickBit(jump ? batch.jumps[d][i] : batch.steps[d][i], n);
+      batch.moveFrom[i] = shiftMask(batch.moveTo[i], -BIT_DIRECTIONS[d] * (jump ? 2 : 1));
+      batch.moveCaptured[i] = jump ? shiftMask(batch.moveTo[i], -BIT_DIRECTIONS[d]) : 0;
+    }
+}
+
+void batchApplyMoves(GameBatch &batch)
+{
+  unsigned long long *pieces1 = &batch.pieces1[0], *pieces2 = &batch.pieces2[0];
+  unsigned long long *kings = &batch.kings[0], *pending = &batch.pending[0];
+  const unsigned long long *from = &batch.moveFrom[0], *to = &batch.moveTo[0], *captured = &batch.moveCaptured[0];
+  int *turn = &batch.turn[0], *plies = &batch.plies[0];
+
+  //Copied out of batch so that the compiler knows the
+  //stores below cannot change it.
+  int size = batch.size;
+
+  for(int i = 0; i < size; i++)
+    {
+      unsigned long long moved = allOnes(from[i] != 0);
+      unsigned long long isP1 = allOnes(turn[i] == 1);
+      unsigned long long mine = select(isP1, pieces1[i], pieces2[i]);
+      unsigned long long theirs = select(isP1, pieces2[i], pieces1[i]);
+      unsigned long long wasKing = allOnes((kings[i] & from[i]) != 0);
+
+      //The same steps as applyBitMove(), on the masks.
+      mine = (mine & ~from[i]) | to[i];
+      theirs &= ~captured[i];
+
+      unsigned long long newKings = (kings[i] & ~(from[i] | captured[i])) | (to[i] & (wasKing | select(isP1, CROWN_ROW[0], CROWN_ROW[1])));
+      unsigned long long empty = ~(mine | theirs);
+
+      //A piece that has just jumped goes again if it can
+      //jump again from where it landed.
+      unsigned long long landed = to[i] & allOnes(captured[i] != 0);
+      unsigned long long down = select(isP1, landed, landed & newKings);
+      unsigned long long up = select(isP1, landed & newKings, landed);
+      unsigned long long again = (((((down & JUMP_FROM[0]) << 9) & theirs) << 9)
+				  | ((((down & JUMP_FROM[1]) << 7) & theirs) << 7)
+				  | ((((up & JUMP_FROM[2]) >> 7) & theirs) >> 7)
+				  | ((((up & JUMP_FROM[3]) >> 9) & theirs) >> 9)) & empty;
+      unsigned long long continues = allOnes(again != 0);
+
+      pieces1[i] = select(moved, select(isP1, mine, theirs), pieces1[i]);
+      pieces2[i] = select(moved, select(isP1, theirs, mine), pieces2[i]);
+      kings[i] = select(moved, newKings, kings[i]);
+      pending[i] = select(moved, landed & continues, pending[i]);
+      //1 ^ 3 is 2 and 2 ^ 3 is 1, so this passes the turn
+      //when the masks say so.
+      turn[i] ^= int(moved & ~continues & 3);
+      plies[i] += int(moved & 1);
+    }
+}
+
+int batchFinishGames(GameBatch &batch)
+{
+  int running = 0;
+  int size = batch.size;
+
+  for(int i = 0; i < size; i++)
+    {
+      int p1 = __builtin_popcountll(batch.pieces1[i]);
+      int p2 = __builtin_popcountll(batch.pieces2[i]);
+      int ended = p1 == 0 ? 2 : p2 == 0 ? 1 : batch.plies[i] >= BATCH_MAX_PLIES ? 3 : 0;
+
+      batch.p1Pieces[i] = p1;
+      batch.p2Pieces[i] = p2;
+      batch.result[i] = batch.result[i] != 0 ? batch.result[i] : ended;
+      running += batch.result[i] == 0;
+    }
+
+  return running;
+}
+
+//Games are handed out to the simulation threads this many at
+//a time, as one batch.
+const int SIMULATION_BATCH_SIZE = 4096;
+
+//What the simulation threads have found between them, guarded
+//by lock.  results[r] counts the games whose result was r.
+struct SimulationState
+{
+  mutex lock;
+  long long nextGame;
+  long long results[4];
+  long long plies;
+};
+
+void simulationWorker(SimulationState &state, long long games, int index)
+{
+  GameBatch batch;
+
+  placeThread(index);
+  allocateBatch(batch, SIMULATION_BATCH_SIZE);
+
+  while(true)
+    {
+      long long first;
+
+      {
+	lock_guard<mutex> guard(state.lock);
+
+	if(state.nextGame >= games)
+	  return;
+
+	first = state.nextGame;
+	state.nextGame += SIMULATION_BATCH_SIZE;
+      }
+
+      TRACE_SCOPE("batch");
+
+      initBatch(batch, min((long long) SIMULATION_BATCH_SIZE, games - first), 0x9E3779B97F4A7C15ULL * (first + 1));
+
+      do
+	{
+	  batchGenerateMoves(batch);
+	  batchChooseMoves(batch);
+	  batchApplyMoves(batch);
+	}
+      while(batchFinishGames(batch) > 0);
+
+      lock_guard<mutex> guard(state.lock);
+
+      for(int i = 0; i < batch.size; i++)
+	{
+	  state.results[batch.result[i]]++;
+	  state.plies += batch.plies[i];
+	}
+    }
+}
+
+void runSimulation(long long games, int threads)
+{
+  SimulationState state;
+  vector<thread> workers;
+
+  if(memoryBudget && threads * batchBytes(SIMULATION_BATCH_SIZE) > arenaAvailable())
+    {
+      cerr << "The memory budget is too small for " << threads << " simulation threads" << endl;
+      return;
+    }
+
+  state.nextGame = 0;
+  state.plies = 0;
+
+  for(int i = 0; i < 4; i++)
+    state.results[i] = 0;
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  for(int i = 0; i < threads; i++)
+    workers.push_back(thread(simulationWorker, ref(state), games, i));
+
+  for(int i = 0; i < threads; i++)
+    workers[i].join();
+
+  double seconds = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count() / 1e6;
+
+  cout << games << " games in " << seconds << " seconds (" << games / seconds << " games/second, "
+       << state.plies / seconds << " plies/second) on " << threads << " threads" << endl;
+  cout << "Player 1 won " << state.results[1] << ", player 2 won " << state.results[2]
+       << ", " << state.results[3] << " drawn, " << double(state.plies) / games << " plies per game" << endl;
+}
+
+//A match game is drawn after this many plies in all, or after
+//this many plies in a row in which nothing was jumped and no
+//standard piece moved (only Kings shuffling about).
+const int MATCH_MAX_PLIES = 300;
+const int MATCH_QUIET_PLIES = 60;
+
+//Number of random plies played from the start to make the
+//opening of each pair of match games.
+const int MATCH_OPENING_PLIES = 4;
+
+//One position of a game played for runExport(): the position,
+//as positionText() writes it, and the search's score there.
+struct TrainingSample
+{
+  string position;
+  int score;
+  int turn;
+};
+
+//playMatchGame() plays one game from start between p1 and p2,
+//and returns player 1's score: 2 for a win, 1 for a draw and
+//0 for a loss.  If samples is not NULL, each position the
+//search does not find a win or loss in is added to it.
+int playMatchGame(Engine &p1, Engine &p2, const Position &start, vector<TrainingSample> *samples)
+{
+  Position pos = start;
+  int quiet = 0;
+
+  clearEngine(p1);
+  clearEngine(p2);
+
+  for(int ply = 0; ply < MATCH_MAX_PLIES && quiet < MATCH_QUIET_PLIES; ply++)
+    {
+      Move move;
+      Engine &mover = pos.turn == 1 ? p1 : p2;
+
+      int score = 0;
+
+      if((pos.turn == 1 ? pos.p1Pieces : pos.p2Pieces) > 0)
+	score = think(mover, pos, move);
+      else
+	move.length = 0;
+
+      if(move.length == 0)
+	return pos.turn == 1 ? 0 : 2;
+
+      if(samples && score <= WIN_BOUND && score >= -WIN_BOUND)
+	{
+	  TrainingSample sample = { positionText(pos.grid, pos.turn), score, pos.turn };
+	  samples->push_back(sample);
+	}
+
+      int piece = pos.grid[move.path[0][0]][move.path[0][1]];
+      bool jumped = move.path[1][0] - move.path[0][0] == 2 || move.path[1][0] - move.path[0][0] == -2;
+
+      makeMove(pos, move);
+
+      if(jumped || piece == 1 || piece == 2)
+	quiet = 0;
+      else
+	quiet++;
+    }
+
+  return 1;
+}
+
+//matchOpening() plays plies random moves from the start, the
+//same ones every time for the same number.
+Position matchOpening(long long number, int plies)
+{
+  unsigned long long state = 0x2545F4914F6CDD1DULL * (number + 1);
+  Position pos;
+  Move moves[MAX_MOVES];
+
+  startPosition(pos);
+
+  for(int ply = 0; ply < plies; ply++)
+    {
+      int count = generateMoves(pos, moves, false);
+
+      if(count == 0)
+	break;
+
+      makeMove(pos, moves[nextRandom(state) % count]);
+    }
+
+  return pos;
+}
+
+//Everything the match threads share, guarded by lock.
+struct MatchState
+{
+  mutex lock;
+  int nextPair;
+  int pairsDone;
+  bool finished;
+
+  //pairs[i] counts the pairs in which the first player
+  //scored i half-points out of 4.
+  long long pairs[5];
+  long long wins, draws, losses;
+};
+
+//The score, per pair of games, as a fraction of the maximum,
+//and its variance, from the pentanomial pair counts.
+void matchScore(const long long pairs[5], double &mean, double &variance)
+{
+  long long total = 0;
+
+  mean = 0;
+  variance = 0;
+
+  for(int i = 0; i < 5; i++)
+    {
+      total += pairs[i];
+      mean += pairs[i] * (i / 4.0);
+    }
+
+  if(total == 0)
+    return;
+
+  mean /= total;
+
+  for(int i = 0; i < 5; i++)
+    variance += pairs[i] * (i / 4.0 - mean) * (i / 4.0 - mean);
+
+  variance /= total;
+}
+
+//eloToScore() gives the expected score of a player who is elo
+//points stronger than his opponent.
+double eloToScore(double elo)
+{
+  return 1 / (1 + pow(10.0, -elo / 400));
+}
+
+//sprtLLR() is the log-likelihood ratio of elo1 against elo0,
+//using the normal approximation of the generalized SPRT over
+//pair scores.  Pairs are used rather than single games because
+//the two games of a pair share an opening, so their results are
+//not independent.
+double sprtLLR(const long long pairs[5], double elo0, double elo1)
+{
+  long long total = 0;
+  double mean, variance;
+
+  for(int i = 0; i < 5; i++)
+    total += pairs[i];
+
+  matchScore(pairs, mean, variance);
+
+  if(total == 0 || variance <= 0)
+    return 0;
+
+  double s0 = eloToScore(elo0), s1 = eloToScore(elo1);
+
+  return total * (s1 - s0) * (2 * mean - s0 - s1) / (2 * variance);
+}
+
+//The error rates of the test: the chance of accepting elo1
+//when elo0 is true, and of accepting elo0 when elo1 is.
+const double SPRT_ALPHA = 0.05;
+const double SPRT_BETA = 0.05;
+
+//The variance estimate behind the test is meaningless after
+//only a few pairs, so the test may not stop before this many.
+const int SPRT_MIN_PAIRS = 20;
+
+void matchWorker(MatchState &state, const EngineConfig &a, const EngineConfig &b, int maxPairs, bool sprt, double elo0, double elo1, int index)
+{
+  Engine engineA, engineB;
+
+  placeThread(index);
+
+  initEngine(engineA, a);
+  initEngine(engineB, b);
+
+  while(true)
+    {
+      int pair;
+
+      {
+	lock_guard<mutex> guard(state.lock);
+
+	if(state.finished || state.nextPair >= maxPairs)
+	  return;
+
+	pair = state.nextPair++;
+      }
+
+      //The same opening is played twice, with each engine
+      //moving first once.  Scores are for engine a.
+      Position opening = matchOpening(pair, MATCH_OPENING_PLIES);
+      int first = playMatchGame(engineA, engineB, opening, NULL);
+      int second = 2 - playMatchGame(engineB, engineA, opening, NULL);
+
+      lock_guard<mutex> guard(state.lock);
+
+      if(state.finished)
+	return;
+
+      state.pairs[first + second]++;
+      state.pairsDone++;
+
+      int results[2] = { first, second };
+
+      for(int g = 0; g < 2; g++)
+	{
+	  if(results[g] == 2)
+	    state.wins++;
+	  else if(results[g] == 1)
+	    state.draws++;
+	  else
+	    state.losses++;
+	}
+
+      double mean, variance;
+      matchScore(state.pairs, mean, variance);
+
+      //Elo from the mean score, and a 95% error bar from
+      //the slope of the Elo curve at that score.
+      double clamped = min(max(mean, 0.001), 0.999);
+      double elo = -400 * log10(1 / clamped - 1);
+      double error = 1.96 * sqrt(variance / state.pairsDone) * 400 / (log(10.0) * clamped * (1 - clamped));
+      long long games = state.wins + state.draws + state.losses;
+
+      cout << "pairs " << state.pairsDone
+	   << "  W-D-L " << state.wins << '-' << state.draws << '-' << state.losses
+	   << "  elo " << showpos << elo << noshowpos << " +/- " << error
+	   << "  draws " << 100.0 * state.draws / games << '%';
+
+      if(sprt)
+	{
+	  double llr = sprtLLR(state.pairs, elo0, elo1);
+	  double lower = log(SPRT_BETA / (1 - SPRT_ALPHA)), upper = log((1 - SPRT_BETA) / SPRT_ALPHA);
+
+	  cout << "  LLR " << llr << " [" << lower << ", " << upper << ']';
+
+	  if(state.pairsDone >= SPRT_MIN_PAIRS && (llr >= upper || llr <= lower))
+	    {
+	      cout << endl << (llr >= upper ? "H1" : "H0") << " accepted: a is "
+		   << (llr >= upper ? elo1 : elo0) << " Elo stronger than b";
+	      state.finished = true;
+	    }
+	}
+
+      cout << endl;
+    }
+}
+
+void runMatch(const EngineConfig &a, const EngineConfig &b, int maxPairs, bool sprt, double elo0, double elo1, int threads)
+{
+  MatchState state;
+  vector<thread> workers;
+
+  state.nextPair = 0;
+  state.pairsDone = 0;
+  state.finished = false;
+  state.wins = state.draws = state.losses = 0;
+
+  for(int i = 0; i < 5; i++)
+    state.pairs[i] = 0;
+
+  cout.precision(3);
+  cout << fixed;
+
+  for(int i = 0; i < threads; i++)
+    workers.push_back(thread(matchWorker, ref(state), cref(a), cref(b), maxPairs, sprt, elo0, elo1, i));
+
+  for(size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+
+  if(sprt && !state.finished)
+    cout << "No decision after " << state.pairsDone << " pairs" << endl;
+}
+
+//Training games start from longer random openings than match
+//games, so that thousands of them seldom play the same game.
+const int EXPORT_OPENING_PLIES = 8;
+
+//Everything the export threads share, guarded by lock.
+struct ExportState
+{
+  mutex lock;
+  long long nextGame;
+  long long positions;
+};
+
+void exportWorker(ExportState &state, const EngineConfig &config, long long games, int index)
+{
+  Engine engine;
+  vector<TrainingSample> samples;
+
+  placeThread(index);
+
+  initEngine(engine, config);
+
+  while(true)
+    {
+      long long game;
+
+      {
+	lock_guard<mutex> guard(state.lock);
+
+	if(state.nextGame >= games)
+	  return;
+
+	game = state.nextGame++;
+      }
+
+      samples.clear();
+
+      int result = playMatchGame(engine, engine, matchOpening(game, EXPORT_OPENING_PLIES), &samples);
+      string text;
+
+      //result is player 1's score out of 2.
+      for(size_t i = 0; i < samples.size(); i++)
+	text += samples[i].position + ' ' + to_string(samples[i].score) + ' '
+	  + to_string(samples[i].turn == 1 ? result - 1 : 1 - result) + '\n';
+
+      lock_guard<mutex> guard(state.lock);
+
+      cout << text;
+      state.positions += samples.size();
+    }
+}
+
+void runExport(long long games, const EngineConfig &config, int threads)
+{
+  ExportState state;
+  vector<thread> workers;
+
+  state.nextGame = 0;
+  state.positions = 0;
+
+  for(int i = 0; i < threads; i++)
+    workers.push_back(thread(exportWorker, ref(state), cref(config), games, i));
+
+  for(size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+
+  cerr << games << " games, " << state.positions << " positions" << endl;
+}
+
+//A proof or disproof number that can no longer be reached.
+const unsigned int PROOF_INFINITY = 0xFFFFFFFF;
+
+//One node of a proof-number search tree.  Nodes do not keep
+//their positions, which would make them far larger; the
+//search replays moves from the root instead, and move is the
+//index of the node's move in generateMoves() order.  OR nodes
+//are those where the player trying to win is to move.  A busy
+//node is being expanded by one of the search threads.  Once a
+//node is solved, distance is the length of the line that
+//proves it, in plies.
+struct ProofNode
+{
+  unsigned int proof;
+  unsigned int disproof;
+  int parent;
+  int firstChild;
+  int nextSibling;
+  unsigned char move;
+  bool orNode;
+  bool expanded;
+  bool busy;
+  short distance;
+};
+
+//A proof-number search tree in a fixed pool of nodes.  Unused
+//nodes are chained together through nextSibling, starting
+//at freeList.  Node 0 is always the root.
+struct ProofTree
+{
+  ProofNode *nodes;
+  long long capacity;
+  int freeList;
+  long long freeCount;
+};
+
+//Collapsed subtrees often have to be grown again, so a
+//table that is much too small for the problem can spend
+//forever collecting.  The search gives up after this many
+//collections.
+const int MAX_PROOF_COLLECTIONS = 64;
+
+//Adds proof or disproof numbers without overflowing.
+unsigned int proofAdd(unsigned int a, unsigned int b)
+{
+  if(a == PROOF_INFINITY || b == PROOF_INFINITY)
+    return PROOF_INFINITY;
+  if(a + b >= PROOF_INFINITY || a + b < a)
+    return PROOF_INFINITY - 1;
+  return a + b;
+}
+
+int allocateProofNode(ProofTree &tree)
+{
+  int index = tree.freeList;
+
+  tree.freeList = tree.nodes[index].nextSibling;
+  tree.freeCount--;
+
+  return index;
+}
+
+//freeProofChildren() returns every descendant of node to the
+//free list, leaving node itself unexpanded but with its proof
+//and disproof numbers as they were.
+void freeProofChildren(ProofTree &tree, int node)
+{
+  vector<int> stack;
+
+  for(int child = tree.nodes[node].firstChild; child != -1; child = tree.nodes[child].nextSibling)
+    stack.push_back(child);
+
+  while(!stack.empty())
+    {
+      int index = stack.back();
+      stack.pop_back();
+
+      for(int child = tree.nodes[index].firstChild; child != -1; child = tree.nodes[child].nextSibling)
+	stack.push_back(child);
+
+      tree.nodes[index].nextSibling = tree.freeList;
+      tree.freeList = index;
+      tree.freeCount++;
+    }
+
+  tree.nodes[node].firstChild = -1;
+  tree.nodes[node].expanded = false;
+}
+
+//lineChild() picks the child of a proved node that continues
+//the proving line: the quickest win where the winner chooses,
+//and the longest resistance where the loser does.
+int lineChild(ProofTree &tree, int node)
+{
+  int best = -1;
+
+  for(int child = tree.nodes[node].firstChild; child != -1; child = tree.nodes[child].nextSibling)
+    {
+      if(tree.nodes[child].proof != 0)
+	continue;
+
+      if(best == -1 || (tree.nodes[node].orNode ? tree.nodes[child].distance < tree.nodes[best].distance
+			: tree.nodes[child].distance > tree.nodes[best].distance))
+	best = child;
+    }
+
+  return best;
+}
+
+//collectProofTree() frees nodes the search no longer needs.
+//First, solved subtrees are cut down to their proving line.
+//If that does not free a quarter of the table, every unsolved
+//subtree that hangs off path (the nodes from the root to the
+//node being expanded) is collapsed as well; those keep their
+//proof and disproof numbers and are grown again if the search
+//comes back to them.  No other thread may be expanding a
+//node while this runs, and no node on path may be solved,
+//or the nodes below it would be freed from under the caller.
+void collectProofTree(ProofTree &tree, const vector<int> &path)
+{
+  vector<int> stack(1, 0);
+
+  while(!stack.empty())
+    {
+      int node = stack.back();
+      stack.pop_back();
+
+      ProofNode &n = tree.nodes[node];
+
+      if(!n.expanded)
+	continue;
+
+      if(n.disproof == 0)
+	{
+	  freeProofChildren(tree, node);
+	  continue;
+	}
+
+      if(n.proof == 0)
+	{
+	  //Keep only the line child, and unlink the rest.
+	  int keep = lineChild(tree, node);
+	  int child = n.firstChild;
+
+	  while(child != -1)
+	    {
+	      int next = tree.nodes[child].nextSibling;
+
+	      if(child != keep)
+		{
+		  freeProofChildren(tree, child);
+		  tree.nodes[child].nextSibling = tree.freeList;
+		  tree.freeList = child;
+		  tree.freeCount++;
+		}
+
+	      child = next;
+	    }
+
+	  n.firstChild = keep;
+	  tree.nodes[keep].nextSibling = -1;
+	  stack.push_back(keep);
+	  continue;
+	}
+
+      for(int child = n.firstChild; child != -1; child = tree.nodes[child].nextSibling)
+	stack.push_back(child);
+    }
+
+  if(tree.freeCount >= tree.capacity / 4)
+    return;
+
+  for(size_t i = 0; i + 1 < path.size(); i++)
+    for(int child = tree.nodes[path[i]].firstChild; child != -1; child = tree.nodes[child].nextSibling)
+      {
+	if(child != path[i + 1] && tree.nodes[child].expanded && tree.nodes[child].proof != 0 && tree.nodes[child].disproof != 0)
+	  freeProofChildren(tree, child);
+      }
+}
+
+//updateProofNode() works out node's proof and disproof
+//numbers, and its distance once solved, from its children.
+void updateProofNode(ProofTree &tree, int node)
+{
+  ProofNode &n = tree.nodes[node];
+  unsigned int minimum = PROOF_INFINITY, sum = 0;
+  int shortest = MAX_MOVES * 1000, longest = 0;
+
+  for(int child = n.firstChild; child != -1; child = tree.nodes[child].nextSibling)
+    {
+      ProofNode &c = tree.nodes[child];
+
+      //For an OR node the proof number is the smallest of
+      //the children's and the disproof number their sum, and
+      //the other way around for an AND node.
+      unsigned int mine = n.orNode ? c.proof : c.disproof;
+      unsigned int theirs = n.orNode ? c.disproof : c.proof;
+
+      minimum = min(minimum, mine);
+      sum = proofAdd(sum, theirs);
+
+      //The winner picks the quickest of its moves that
+      //work; the loser holds out as long as it can.
+      if(mine == 0)
+	shortest = min(shortest, (int) c.distance);
+      longest = max(longest, (int) c.distance);
+    }
+
+  n.proof = n.orNode ? minimum : sum;
+  n.disproof = n.orNode ? sum : minimum;
+
+  if(minimum == 0)
+    n.distance = shortest + 1;
+  else if(sum == 0)
+    n.distance = longest + 1;
+}
+
+//What a proof-number search found out.
+enum SolveResult
+  {
+    SOLVE_PROVED,
+    SOLVE_DISPROVED,
+    SOLVE_UNKNOWN
+  };
+
+//One proof-number search, shared by all of the threads working
+//on it.  Everything but root, attacker and maxPlies is guarded
+//by lock.  inFlight counts the threads busy expanding a node;
+//while collecting is set, no thread starts a new expansion, so
+//that the collecting thread can wait for inFlight to drop to 1.
+struct ProofSearch
+{
+  Position root;
+  int attacker;
+  int maxPlies;
+
+  ProofTree tree;
+  mutex lock;
+  condition_variable idle;
+  int inFlight;
+  bool collecting;
+  bool failed;
+  int collections;
+};
+
+//proofWorker() is the loop each search thread runs: pick the
+//most-proving node that no other thread is working on, replay
+//its moves and classify its children without holding the lock,
+//then link the children in and update the numbers back up to
+//the root.
+void proofWorker(ProofSearch &search)
+{
+  ProofTree &tree = search.tree;
+  Move moves[MAX_MOVES], replies[MAX_MOVES];
+  vector<int> path;
+  vector<unsigned char> pathMoves;
+  vector<unsigned long long> keys;
+  unsigned int childProof[MAX_MOVES], childDisproof[MAX_MOVES];
+
+  unique_lock<mutex> guard(search.lock);
+
+  while(true)
+    {
+      while(search.collecting)
+	search.idle.wait(guard);
+
+      if(search.failed || tree.nodes[0].proof == 0 || tree.nodes[0].disproof == 0)
+	break;
+
+      //Walk down to the most-proving node, skipping nodes
+      //other threads are expanding.
+      int node = 0;
+      bool blocked = false;
+
+      path.assign(1, 0);
+      pathMoves.clear();
+
+      while(tree.nodes[node].expanded)
+	{
+	  ProofNode &n = tree.nodes[node];
+	  int best = -1;
+
+	  for(int child = n.firstChild; child != -1; child = tree.nodes[child].nextSibling)
+	    {
+	      ProofNode &c = tree.nodes[child];
+
+	      if(c.busy || c.proof == 0 || c.disproof == 0)
+		continue;
+
+	      if(best == -1 || (n.orNode ? c.proof < tree.nodes[best].proof : c.disproof < tree.nodes[best].disproof))
+		best = child;
+	    }
+
+	  if(best == -1)
+	    {
+	      blocked = true;
+	      break;
+	    }
+
+	  node = best;
+	  path.push_back(node);
+	  pathMoves.push_back(tree.nodes[node].move);
+	}
+
+      //Everything worth expanding here is already being
+      //expanded; let the other threads get on with it.
+      if(blocked || tree.nodes[node].busy)
+	{
+	  guard.unlock();
+	  this_thread::yield();
+	  guard.lock();
+	  continue;
+	}
+
+      tree.nodes[node].busy = true;
+      search.inFlight++;
+      guard.unlock();
+
+      //Replay the moves down to the node, remembering the
+      //positions passed through.
+      Position pos = search.root;
+
+      keys.assign(1, hashPosition(pos));
+
+      for(size_t i = 0; i < pathMoves.size(); i++)
+	{
+	  generateMoves(pos, moves, false);
+	  makeMove(pos, moves[pathMoves[i]]);
+	  keys.push_back(hashPosition(pos));
+	}
+
+      int ply = pathMoves.size();
+      int count = generateMoves(pos, moves, false);
+      bool terminal = count == 0 || (pos.turn == 1 ? pos.p1Pieces : pos.p2Pieces) == 0;
+
+      for(int i = 0; i < count && !terminal; i++)
+	{
+	  Position next = pos;
+	  makeMove(next, moves[i]);
+
+	  childProof[i] = 1;
+	  childDisproof[i] = 1;
+
+	  //A side with no pieces has lost.  The attacker has
+	  //failed if the game is still going after maxPlies
+	  //plies, or if the position repeats one earlier on
+	  //the path, since Kings going round in circles never
+	  //win anything.  A side that cannot move has lost
+	  //too, which only needs checking here when the game
+	  //would otherwise be cut off, since expanding the
+	  //child finds it.
+	  bool cut = ply + 1 >= search.maxPlies || find(keys.begin(), keys.end(), hashPosition(next)) != keys.end();
+	  bool lost = (next.turn == 1 ? next.p1Pieces : next.p2Pieces) == 0;
+
+	  if(!lost && cut)
+	    lost = generateMoves(next, replies, false) == 0;
+
+	  if(lost)
+	    {
+	      childProof[i] = next.turn == search.attacker ? PROOF_INFINITY : 0;
+	      childDisproof[i] = next.turn == search.attacker ? 0 : PROOF_INFINITY;
+	    }
+	  else if(cut)
+	    {
+	      childProof[i] = PROOF_INFINITY;
+	      childDisproof[i] = 0;
+	    }
+	}
+
+      guard.lock();
+
+      //Another thread may have solved one of node's ancestors
+      //in the meantime.  Node no longer matters then, and a
+      //collection would free it, so the work is thrown away.
+      bool moot = false;
+
+      for(size_t i = 0; i + 1 < path.size(); i++)
+	if(tree.nodes[path[i]].proof == 0 || tree.nodes[path[i]].disproof == 0)
+	  moot = true;
+
+      if(moot)
+	{
+	  tree.nodes[node].busy = false;
+	  search.inFlight--;
+	  search.idle.notify_all();
+	  continue;
+	}
+
+      if(!terminal && tree.freeCount < count)
+	{
+	  //Only one thread can collect at a time.  Any other
+	  //that runs out of room throws its work away and
+	  //tries again once the collection is done.
+	  if(search.collecting)
+	    {
+	      tree.nodes[node].busy = false;
+	      search.inFlight--;
+	      search.idle.notify_all();
+	      continue;
+	    }
+
+	  if(++search.collections > MAX_PROOF_COLLECTIONS)
+	    {
+	      search.failed = true;
+	      tree.nodes[node].busy = false;
+	      search.inFlight--;
+	      search.idle.notify_all();
+	      break;
+	    }
+
+	  search.collecting = true;
+
+	  while(search.inFlight > 1)
+	    search.idle.wait(guard);
+
+	  collectProofTree(tree, path);
+	  search.collecting = false;
+	  search.idle.notify_all();
+
+	  if(tree.freeCount < count)
+	    {
+	      search.failed = true;
+	      tree.nodes[node].busy = false;
+	      search.inFlight--;
+	      break;
+	    }
+	}
+
+      //Running out of pieces or moves loses.
+      if(terminal)
+	{
+	  tree.nodes[node].proof = pos.turn == search.attacker ? PROOF_INFINITY : 0;
+	  tree.nodes[node].disproof = pos.turn == search.attacker ? 0 : PROOF_INFINITY;
+	  tree.nodes[node].distance = 0;
+	}
+      else
+	{
+	  int previous = -1;
+
+	  for(int i = 0; i < count; i++)
+	    {
+	      int child = allocateProofNode(tree);
+	      ProofNode &c = tree.nodes[child];
+
+	      c.proof = childProof[i];
+	      c.disproof = childDisproof[i];
+	      c.parent = node;
+	      c.firstChild = -1;
+	      c.nextSibling = -1;
+	      c.move = i;
+	      c.orNode = !tree.nodes[node].orNode;
+	      c.expanded = false;
+	      c.busy = false;
+	      c.distance = 0;
+
+	      if(previous == -1)
+		tree.nodes[node].firstChild = child;
+	      else
+		tree.nodes[previous].nextSibling = child;
+	      previous = child;
+	    }
+
+	  tree.nodes[node].expanded = true;
+	  updateProofNode(tree, node);
+	}
+
+      for(int ancestor = tree.nodes[node].parent; ancestor != -1; ancestor = tree.nodes[ancestor].parent)
+	updateProofNode(tree, ancestor);
+
+      tree.nodes[node].busy = false;
+      search.inFlight--;
+
+      if(search.collecting)
+	search.idle.notify_all();
+    }
+
+  //Wake anyone still waiting for a collection that will
+  //never come.
+  search.idle.notify_all();
+}
+
+//proofSearch() runs proof-number search from root on threads
+//threads, trying to prove that attacker wins within maxPlies
+//plies, using the table of capacity nodes at nodes.  If it succeeds, line
+//is set to the proving line.  If the table is too small to
+//finish, it returns SOLVE_UNKNOWN.
+SolveResult proofSearch(const Position &root, int attacker, int maxPlies, ProofNode *nodes, long long capacity, int threads, vector<Move> &line)
+{
+  TRACE_SCOPE("proof search");
+
+  ProofSearch search;
+  ProofTree &tree = search.tree;
+
+  search.root = root;
+  search.attacker = attacker;
+  search.maxPlies = maxPlies;
+  search.inFlight = 0;
+  search.collecting = false;
+  search.failed = false;
+  search.collections = 0;
+
+  tree.nodes = nodes;
+  tree.capacity = capacity;
+  tree.freeCount = capacity;
+  tree.freeList = 0;
+
+  for(long long i = 0; i < capacity; i++)
+    tree.nodes[i].nextSibling = i + 1 < capacity ? i + 1 : -1;
+
+  ProofNode &r = tree.nodes[allocateProofNode(tree)];
+
+  r.proof = 1;
+  r.disproof = 1;
+  r.parent = -1;
+  r.firstChild = -1;
+  r.nextSibling = -1;
+  r.move = 0;
+  r.orNode = root.turn == attacker;
+  r.expanded = false;
+  r.busy = false;
+  r.distance = 0;
+
+  vector<thread> workers;
+
+  for(int i = 0; i < threads; i++)
+    workers.push_back(thread(proofWorker, ref(search)));
+
+  for(int i = 0; i < threads; i++)
+    workers[i].join();
+
+  if(tree.nodes[0].disproof == 0)
+    return SOLVE_DISPROVED;
+
+  if(tree.nodes[0].proof != 0)
+    return SOLVE_UNKNOWN;
+
+  //Follow the proving line down from the root.
+  Position pos = root;
+  Move moves[MAX_MOVES];
+
+  line.clear();
+
+  for(int node = 0; tree.nodes[node].expanded; )
+    {
+      int child = lineChild(tree, node);
+
+      generateMoves(pos, moves, false);
+      line.push_back(moves[tree.nodes[child].move]);
+      makeMove(pos, moves[tree.nodes[child].move]);
+      node = child;
+    }
+
+  return SOLVE_PROVED;
+}
+
+void runSolver(const Position &pos, int maxPlies, long long nodes, int threads)
+{
+  TRACE_SCOPE("solve");
+
+  int other = pos.turn == 1 ? 2 : 1;
+  vector<Move> line;
+
+  if(memoryBudget)
+    {
+      if(arenaAvailable() > BLOCK_ALIGNMENT)
+	nodes = min(nodes, (long long) ((arenaAvailable() - BLOCK_ALIGNMENT) / sizeof(ProofNode)));
+
+      if(arenaAvailable() <= BLOCK_ALIGNMENT || nodes < 1000)
+	{
+	  cout << "The memory budget is too small for the solver" << endl;
+	  return;
+	}
+    }
+
+  //Both searches use the same table.
+  ProofNode *table = (ProofNode *) allocateBlock(nodes * sizeof(ProofNode), "proof node table");
+
+  cout << "Solving for player " << pos.turn << " to move, up to " << maxPlies << " plies, "
+       << nodes << " nodes, " << threads << " threads" << endl;
+
+  //First try to prove a win for the side to move, then a
+  //win for the other side.  If both are disproved, neither
+  //side can force a win within maxPlies.
+  SolveResult win = proofSearch(pos, pos.turn, maxPlies, table, nodes, threads, line);
+  int winner = pos.turn;
+
+  if(win != SOLVE_PROVED)
+    {
+      SolveResult loss = proofSearch(pos, other, maxPlies, table, nodes, threads, line);
+
+      if(loss != SOLVE_PROVED)
+	{
+	  if(win == SOLVE_DISPROVED && loss == SOLVE_DISPROVED)
+	    cout << "Draw: neither player can force a win within " << maxPlies << " plies" << endl;
+	  else
+	    cout << "Unknown: the node table was too small to finish the proof (try --solve-nodes)" << endl;
+	  return;
+	}
+
+      winner = other;
+    }
+
+  cout << "Player " << winner << " wins in " << line.size() << " plies:";
+
+  for(size_t i = 0; i < line.size(); i++)
+    cout << ' ' << moveText(line[i]);
+
+  cout << endl;
+}
+
+//A move that loses at least this much against the computer's
+//choice, in hundredths of a piece, is flagged as a mistake,
+//and at least this much as a blunder.
+const int MISTAKE_LOSS = 50;
+const int BLUNDER_LOSS = 150;
+
+//No more than this many games are read ahead of the first one
+//still being annotated, so that a file of any length takes a
+//bounded amount of memory.
+const int ANNOTATION_WINDOW_GAMES = 1024;
+
+//One game being annotated: the line of the file it came from,
+//its moves, and for each of its positions (one more than it has
+//moves) the computer's score for the side to move and the move
+//it would play.  pending counts the positions not analysed yet.
+//If the game could not be read, or has an illegal move, error
+//says why instead.
+struct AnnotatedGame
+{
+  int line;
+  vector<Move> moves;
+  vector<int> scores;
+  vector<Move> best;
+  string error;
+  atomic<int> pending;
+};
+
+//One position to analyse: the one before move ply of game.
+struct AnnotationTask
+{
+  AnnotatedGame *game;
+  int ply;
+};
+
+//Each annotation thread has a queue of tasks of its own.  It
+//takes tasks from the back of its queue, and a thread that has
+//run out steals from the front of another's, which holds the
+//work its owner would have got to last.
+struct TaskQueue
+{
+  mutex lock;
+  deque<AnnotationTask> tasks;
+};
+
+//What the annotation threads share: one queue per thread, and
+//queued, the number of tasks in all of them.  The threads run
+//for the whole file.  One that finds every queue empty waits on
+//work until more games are read or stopping is set, and each
+//game finished is signalled on finished, for runAnnotation() to
+//write it out.  queued is only raised, and stopping only set,
+//under lock.
+struct AnnotationPool
+{
+  unique_ptr<TaskQueue[]> queues;
+  int threads;
+  atomic<long long> steals;
+  atomic<long long> queued;
+  bool stopping;
+  mutex lock;
+  condition_variable work;
+  condition_variable finished;
+};
+
+//readGame() reads the moves of a game from text into game,
+//checking each against the rules.
+void readGame(const string &text, AnnotatedGame &game)
+{
+  Position pos;
+  size_t end = 0;
+
+  startPosition(pos);
+
+  while(true)
+    {
+      size_t start = text.find_first_not_of(" \t\r", end);
+
+      if(start == string::npos)
+	break;
+
+      end = text.find_first_of(" \t\r", start);
+
+      string word = text.substr(start, end - start);
+      Move move;
+
+      if(!readMove(word.c_str(), move))
+	{
+	  game.error = "cannot read move " + word;
+	  return;
+	}
+
+      if(findMove(pos, move) < 0)
+	{
+	  game.error = "illegal move " + word + " at ply " + to_string(game.moves.size() + 1);
+	  return;
+	}
+
+      game.moves.push_back(move);
+      makeMove(pos, move);
+    }
+
+  game.scores.resize(game.moves.size() + 1);
+  game.best.resize(game.moves.size() + 1);
+}
+
+//takeTask() takes a task from the back of queue, or from the
+//front if steal is set.  Returns false if the queue is empty.
+bool takeTask(TaskQueue &queue, AnnotationTask &task, bool steal)
+{
+  lock_guard<mutex> guard(queue.lock);
+
+  if(queue.tasks.empty())
+    return false;
+
+  if(steal)
+    {
+      task = queue.tasks.front();
+      queue.tasks.pop_front();
+    }
+  else
+    {
+      task = queue.tasks.back();
+      queue.tasks.pop_back();
+    }
+
+  return true;
+}
+
+void annotationWorker(AnnotationPool &pool, Engine &engine, int self)
+{
+  TRACE_SCOPE("annotation thread");
+
+  placeThread(self);
+
+  while(true)
+    {
+      AnnotationTask task;
+      bool found = takeTask(pool.queues[self], task, false);
+
+      for(int i = 1; i < pool.threads && !found; i++)
+	{
+	  found = takeTask(pool.queues[(self + i) % pool.threads], task, true);
+
+	  if(found)
+	    pool.steals.fetch_add(1, memory_order_relaxed);
+	}
+
+      if(!found)
+	{
+	  unique_lock<mutex> guard(pool.lock);
+
+	  while(pool.queued == 0 && !pool.stopping)
+	    pool.work.wait(guard);
+
+	  if(pool.queued == 0)
+	    return;
+	  continue;
+	}
+
+      pool.queued--;
+
+      AnnotatedGame &game = *task.game;
+      Position pos;
+
+      startPosition(pos);
+
+      for(int i = 0; i < task.ply; i++)
+	makeMove(pos, game.moves[i]);
+
+      game.scores[task.ply] = think(engine, pos, game.best[task.ply]);
+
+      if(game.pending.fetch_sub(1) == 1)
+	{
+	  lock_guard<mutex> guard(pool.lock);
+	  pool.finished.notify_one();
+	}
+    }
+}
+
+//jsonText() returns text as a JSON string, quotes included.
+string jsonText(const string &text)
+{
+  string json = "\"";
+
+  for(size_t i = 0; i < text.size(); i++)
+    {
+      unsigned char c = text[i];
+
+      if(c == '"' || c == '\\')
+	json += string("\\") + char(c);
+      else if(c < 0x20)
+	{
+	  char escaped[8];
+
+	  snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+	  json += escaped;
+	}
+      else
+	json += char(c);
+    }
+
+  return json + '"';
+}
+
+//writeAnnotation() writes game as a line of JSON.  The score of
+//a move played is the score of the position it led to, turned
+//round to the point of view of the player who made it.
+void writeAnnotation(const AnnotatedGame &game)
+{
+  cout << "{\"line\":" << game.line;
+
+  if(!game.error.empty())
+    {
+      cout << ",\"error\":" << jsonText(game.error) << "}" << endl;
+      return;
+    }
+
+  cout << ",\"moves\":[";
+
+  for(size_t ply = 0; ply < game.moves.size(); ply++)
+    {
+      const Move &best = game.best[ply];
+      const Move &played = game.moves[ply];
+      int score = -game.scores[ply + 1];
+      int loss = max(game.scores[ply] - score, 0);
+
+      if(best.length == played.length && memcmp(best.path, played.path, played.length * sizeof(played.path[0])) == 0)
+	loss = 0;
+
+      cout << (ply > 0 ? "," : "") << "{\"ply\":" << ply + 1 << ",\"move\":\"" << moveText(played)
+	   << "\",\"score\":" << score << ",\"best\":\"" << moveText(best) << "\",\"best_score\":" << game.scores[ply]
+	   << ",\"loss\":" << loss << ",\"flag\":\"" << (loss >= BLUNDER_LOSS ? "??" : loss >= MISTAKE_LOSS ? "?" : "") << "\"}";
+    }
+
+  cout << "]}" << endl;
+}
+
+void runAnnotation(const char *file, const EngineConfig &config, int threads)
+{
+  TRACE_SCOPE("annotate");
+
+  ifstream in(file);
+
+  if(!in)
+    {
+      cerr << "Could not read " << file << endl;
+      return;
+    }
+
+  //Each thread keeps its engine, and so its transposition
+  //table, from one game to the next.
+  unique_ptr<Engine[]> engines(new Engine[threads]);
+
+  for(int i = 0; i < threads; i++)
+    initEngine(engines[i], config);
+
+  //games holds the games read and not yet written, in file
+  //order.  A deque, because the threads hold on to games while
+  //games come and go at its ends.
+  AnnotationPool pool;
+  deque<AnnotatedGame> games;
+  vector<thread> workers;
+  string text;
+  int line = 0;
+  long long gameCount = 0, positions = 0;
+  bool more = true;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  pool.queues.reset(new TaskQueue[threads]);
+  pool.threads = threads;
+  pool.steals = 0;
+  pool.queued = 0;
+  pool.stopping = false;
+
+  for(int i = 0; i < threads; i++)
+    workers.push_back(thread(annotationWorker, ref(pool), ref(engines[i]), i));
+
+  while(more || !games.empty())
+    {
+      long long added = 0;
+
+      while(more && games.size() < (size_t) ANNOTATION_WINDOW_GAMES)
+	{
+	  if(!getline(in, text))
+	    {
+	      more = false;
+	      break;
+	    }
+
+	  line++;
+
+	  if(text.find_first_not_of(" \t\r") == string::npos)
+	    continue;
+
+	  games.emplace_back();
+
+	  AnnotatedGame &game = games.back();
+
+	  game.line = line;
+	  game.pending = 0;
+	  readGame(text, game);
+
+	  if(!game.error.empty())
+	    continue;
+
+	  //Deal the games out whole, so that each thread starts
+	  //with runs of positions from the same game, which share
+	  //much of their search in the transposition table.
+	  //They are counted before they are queued, so that a
+	  //thread taking one never finds the count short.
+	  TaskQueue &queue = pool.queues[(gameCount + games.size()) % threads];
+
+	  {
+	    lock_guard<mutex> guard(pool.lock);
+	    pool.queued += game.moves.size() + 1;
+	  }
+
+	  lock_guard<mutex> guard(queue.lock);
+
+	  game.pending = game.moves.size() + 1;
+
+	  for(size_t ply = 0; ply <= game.moves.size(); ply++)
+	    {
+	      AnnotationTask task = { &game, (int) ply };
+
+	      queue.tasks.push_back(task);
+	    }
+
+	  added += game.moves.size() + 1;
+	}
+
+      unique_lock<mutex> guard(pool.lock);
+
+      if(added > 0)
+	{
+	  positions += added;
+	  pool.work.notify_all();
+	}
+
+      //Write out the games at the front that are done, and
+      //wait for the first one that is not.
+      while(!games.empty() && games.front().pending > 0)
+	pool.finished.wait(guard);
+
+      guard.unlock();
+
+      while(!games.empty() && games.front().pending == 0)
+	{
+	  writeAnnotation(games.front());
+	  games.pop_front();
+	  gameCount++;
+	}
+    }
+
+  {
+    lock_guard<mutex> guard(pool.lock);
+    pool.stopping = true;
+  }
+
+  pool.work.notify_all();
+
+  for(int i = 0; i < threads; i++)
+    workers[i].join();
+
+  double seconds = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count() / 1e6;
+
+  cerr << gameCount << " games, " << positions << " positions in " << seconds << " seconds ("
+       << positions / seconds << " positions/second) on " << threads << " threads, "
+       << pool.steals << " positions stolen" << endl;
+}
+
+int replayGame(char *line, Position &pos, char *&bad, bool (*play)(Position &, const Move &))
+{
+  const char *spaces = " \t\r";
+  char *word = line + strspn(line, spaces);
+  int played = 0;
+
+  bad = NULL;
+  startPosition(pos);
+
+  //Each word is cut off where it ends while it is read, and
+  //put back afterwards.  A position is told from a move by its
+  //first character.
+  if(*word != '\0' && strchr(".xoXO", *word) != NULL)
+    {
+      char *end = word + strcspn(word, spaces);
+      char saved = *end;
+
+      *end = '\0';
+      bool read = readPosition(word, pos.grid, pos.turn);
+      *end = saved;
+
+      if(!read)
+	{
+	  bad = word;
+	  return -1;
+	}
+
+      countPieces(pos.grid, pos.p1Pieces, pos.p2Pieces);
+      word = end + strspn(end, spaces);
+    }
+
+  while(*word != '\0')
+    {
+      char *end = word + strcspn(word, spaces);
+      char saved = *end;
+      Move move;
+
+      *end = '\0';
+      bool legal = readMove(word, move) && play(pos, move);
+      *end = saved;
+
+      if(!legal)
+	{
+	  bad = word;
+	  return played;
+	}
+
+      played++;
+      word = end + strspn(end, spaces);
+    }
+
+  return played;
+}
+
+bool runReplay(const char *file)
+{
+  TRACE_SCOPE("replay");
+
+  ifstream fileIn;
+  istream *in = &cin;
+
+  if(strcmp(file, "-") != 0)
+    {
+      fileIn.open(file);
+
+      if(!fileIn)
+	{
+	  cerr << "Could not read " << file << endl;
+	  return false;
+	}
+
+      in = &fileIn;
+    }
+
+  string text;
+  long long games = 0, moves = 0, failed = 0;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  while(getline(*in, text))
+    {
+      if(text.find_first_not_of(" \t\r") == string::npos)
+	continue;
+
+      Position pos;
+      char *bad;
+      int played = replayGame(&text[0], pos, bad, checkMove);
+
+      games++;
+
+      if(played > 0)
+	moves += played;
+
+      if(bad == NULL)
+	continue;
+
+      failed++;
+
+      if(played < 0)
+	cout << "game " << games << ": bad position " << string(bad, strcspn(bad, " \t\r")) << '\n';
+      else
+	cout << "game " << games << ": move " << played + 1 << ", " << string(bad, strcspn(bad, " \t\r"))
+	     << ", is illegal\n";
+    }
+
+  double seconds = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count() / 1e6;
+
+  cerr << games << " games, " << moves << " moves in " << seconds << " seconds (" << moves / seconds
+       << " moves/second), " << failed << " with an illegal move" << endl;
+
+  return failed == 0;
+}
+
+//One root move of a multi-PV analysis and its score in the
+//last iteration that finished: exact for the lines that made
+//the top, and no more than the worst of them for the rest.
+struct AnalysisLine
+{
+  Move move;
+  int score;
+};
+
+bool betterLine(const AnalysisLine &a, const AnalysisLine &b)
+{
+  return a.score > b.score;
+}
+
+//principalVariation() follows the transposition table's best
+//moves from pos for up to length plies, and returns them as
+//moveText() writes them, each after a space.
+string principalVariation(Engine &engine, Position pos, int length)
+{
+  string text;
+  Move moves[MAX_MOVES];
+
+  //Stops at the first position the table has no exact score
+  //for, since its move there may be no better than any other.
+  for(int ply = 0; ply < length; ply++)
+    {
+      bool flipped;
+      unsigned long long key = canonicalHash(pos, flipped);
+      const TableEntry &entry = engine.table[key & (engine.tableSize - 1)];
+
+      if(entry.key != key || entry.bound != BOUND_EXACT)
+	break;
+
+      int from = flipped ? 63 - entry.bestFrom : entry.bestFrom;
+      int to = flipped ? 63 - entry.bestTo : entry.bestTo;
+      int count = generateMoves(pos, moves, false), i = 0;
+
+      while(i < count && (moves[i].path[0][0] * 8 + moves[i].path[0][1] != from
+			  || moves[i].path[moves[i].length - 1][0] * 8 + moves[i].path[moves[i].length - 1][1] != to))
+	i++;
+
+      if(i == count)
+	break;
+
+      text += ' ' + moveText(moves[i]);
+      makeMove(pos, moves[i]);
+    }
+
+  return text;
+}
+
+//analyseRoot() searches every root move of pos in lines to
+//depth plies and sorts lines by score, best first.  Only the
+//top count need exact scores, so once count moves have been
+//searched, each further move is first searched with a null
+//window at the worst score among the top count so far, and
+//searched in full only if it beats that.  All the moves share
+//the engine's transposition table, so each search is ordered by
+//what the others found.  Returns false, leaving lines as they
+//were, if the search was stopped.
+bool analyseRoot(Engine &engine, Position &pos, AnalysisLine lines[], int moveCount, int count, int depth)
+{
+  int scores[MAX_MOVES];
+  int top[MAX_MOVES];
+  int found = 0;
+
+  for(int i = 0; i < moveCount; i++)
+    {
+      Position child = pos;
+      makeMove(child, lines[i].move);
+      enterChild(engine, pos, child, lines[i].move, 0);
+
+      int score;
+
+      if(found < count)
+	score = -alphaBeta(engine, child, depth - 1, -INFINITE_SCORE, INFINITE_SCORE, 1);
+      else
+	{
+	  int floor = top[count - 1];
+
+	  score = -alphaBeta(engine, child, depth - 1, -floor - 1, -floor, 1);
+
+	  if(score > floor && !engine.stopped)
+	    score = -alphaBeta(engine, child, depth - 1, -INFINITE_SCORE, -floor, 1);
+	}
+
+      if(engine.stopped)
+	return false;
+
+      scores[i] = score;
+
+      //top holds the best scores so far, best first.
+      int k = found < count ? found++ : count;
+
+      while(k > 0 && top[k - 1] < score)
+	{
+	  if(k < count)
+	    top[k] = top[k - 1];
+	  k--;
+	}
+
+      if(k < count)
+	top[k] = score;
+    }
+
+  for(int i = 0; i < moveCount; i++)
+    lines[i].score = scores[i];
+
+  stable_sort(lines, lines + moveCount, betterLine);
+  return true;
+}
+
+void runAnalysis(const Position &start, const EngineConfig &config, int count)
+{
+  TRACE_SCOPE("analysis");
+
+  Engine engine;
+  Position pos = start;
+  AnalysisLine lines[MAX_MOVES];
+  Move moves[MAX_MOVES];
+  int moveCount = (pos.turn == 1 ? pos.p1Pieces : pos.p2Pieces) > 0 ? generateMoves(pos, moves, false) : 0;
+
+  if(moveCount == 0)
+    {
+      cout << "{\"lines\":0}" << endl;
+      return;
+    }
+
+  for(int i = 0; i < moveCount; i++)
+    {
+      lines[i].move = moves[i];
+      lines[i].score = 0;
+    }
+
+  count = min(count, moveCount);
+
+  initEngine(engine, config);
+  engine.started = chrono::steady_clock::now();
+  engine.nodes = 0;
+  engine.nextPoll = ENGINE_POLL_NODES;
+  engine.stopped = false;
+
+  enterRoot(engine, pos);
+
+  for(int depth = 1; depth <= config.depth; depth++)
+    {
+      //As in think(), the first iteration always finishes.
+      engine.nodeLimit = depth == 1 ? 0 : config.nodes;
+      engine.iteration = depth;
+
+      if(!analyseRoot(engine, pos, lines, moveCount, count, depth))
+	break;
+
+      long long micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - engine.started).count();
+
+      for(int i = 0; i < count; i++)
+	{
+	  Position child = pos;
+	  makeMove(child, lines[i].move);
+
+	  cout << "{\"depth\":" << depth << ",\"line\":" << i + 1 << ",\"score\":" << lines[i].score
+	       << ",\"nodes\":" << engine.nodes << ",\"ms\":" << micros / 1000.0
+	       << ",\"pv\":\"" << moveText(lines[i].move) << principalVariation(engine, child, depth - 1) << "\"}\n";
+	}
+
+      cout.flush();
+
+      //Once every line shown is a known win or loss, looking
+      //deeper changes nothing.
+      bool decided = true;
+
+      for(int i = 0; i < count; i++)
+	if(lines[i].score <= WIN_BOUND && lines[i].score >= -WIN_BOUND)
+	  decided = false;
+
+      if(decided)
+	break;
+    }
+}
+
+#ifdef __linux__
+//Each session buffers this much of its client's input (one
+//command at most) and of the output the client has not taken
+//yet.
+const int SESSION_INPUT_SIZE = 128;
+const int SESSION_OUTPUT_SIZE = 2048;
+
+//How many broadcasts a viewer can have waiting to be sent.  A
+//viewer that falls further behind is disconnected.
+const int VIEWER_QUEUE_SIZE = 16;
+
+//A game can be watched as moves (the position, then each move
+//as it is played) or as boards (the board drawn afresh after
+//each move, as drawBoard() draws it).
+enum WatchMode
+  {
+    WATCH_MOVES,
+    WATCH_BOARDS
+  };
+
+//One update of a game, encoded once for all its viewers: a
+//move, a board, a snapshot for viewers joining late, or the end
+//of the game.  Broadcasts are never changed once made, and
+//every viewer it is queued for sends it straight from here;
+//references counts those, and whoever else holds it, and the
+//last to let go frees it.  text is length bytes long.
+struct Broadcast
+{
+  int references;
+  int length;
+  char text[1];
+};
+
+//One game hosted by the server, for one connection.  Sessions
+//live in a pool allocated once at startup, and unused ones are
+//chained together through next.  computer is the player the
+//computer plays, or 0.  generation changes whenever a computer
+//move being worked out stops being wanted (a new game is
+//started, or the client goes away), so that the move is thrown
+//away when it arrives.  asked is when the computer was asked
+//for its move.  A closing session is closed once the event
+//that made it so has been dealt with.  history is kept for the
+//snapshots the save command hands out.  journalGame is the
+//game's number in the journal, or 0 until its first move is
+//journaled.
+//
+//A session watching another's game has its index in watching
+//(otherwise -1) and the mode in watchMode, and is chained into
+//that session's viewers through prevViewer and nextViewer.
+//Broadcasts waiting to be sent to it are queued, queueLength
+//of them from queueStart in a ring, of which the first
+//queueOffset bytes have gone already.  A watched session has
+//its first viewer in firstViewer, counts them by mode in
+//viewers, and keeps in latest, for each mode, the snapshot a
+//viewer joining now would be sent, once one has been made.
+struct Session
+{
+  int fd;
+  int next;
+  unsigned int generation;
+  Position pos;
+  GameHistory history;
+  unsigned long long journalGame;
+  int computer;
+  bool thinking;
+  bool over;
+  bool closing;
+  bool waitingToWrite;
+  chrono::steady_clock::time_point asked;
+  int inLength;
+  int outLength;
+  char in[SESSION_INPUT_SIZE];
+  char out[SESSION_OUTPUT_SIZE];
+
+  int watching;
+  WatchMode watchMode;
+  int prevViewer;
+  int nextViewer;
+  int queueStart;
+  int queueLength;
+  int queueOffset;
+  Broadcast *queued[VIEWER_QUEUE_SIZE];
+  int firstViewer;
+  int viewers[2];
+  Broadcast *latest[2];
+};
+
+//A position for the engine threads to find a move in, and,
+//once they have, the move.
+struct EngineJob
+{
+  int session;
+  unsigned int generation;
+  Position pos;
+  Move move;
+};
+
+//Computer move latencies are counted in buckets by powers of
+//two: bucket k counts those under 2^k microseconds.
+const int LATENCY_BUCKETS = 32;
+
+//epoll tells the server's own descriptors apart from sessions
+//by these, which are never session indexes.
+const unsigned long long LISTEN_TAG = ~0ULL;
+const unsigned long long WAKE_TAG = ~0ULL - 1;
+const unsigned long long SIGNAL_TAG = ~0ULL - 2;
+
+//Everything the server keeps.  jobs and results are guarded by
+//jobLock: the engine threads wait on jobReady for jobs, and
+//once a job is done they add it to results and wake the epoll
+//loop through wakeFd, an eventfd.
+struct Server
+{
+  int epollFd;
+  int listenFd;
+  int wakeFd;
+  int signalFd;
+  Session *sessions;
+  int maxSessions;
+  int freeList;
+  int active;
+
+  mutex jobLock;
+  condition_variable jobReady;
+  deque<EngineJob> jobs;
+  vector<EngineJob> results;
+  bool stopping;
+
+  long long connections;
+  long long commands;
+  long long engineMoves;
+  long long latencyTotal;
+  long long latencyMax;
+  long long latency[LATENCY_BUCKETS];
+
+  int watchers;
+  long long broadcasts;
+  long long broadcastBytes;
+  long long deliveries;
+};
+
+//openListener() opens a listening socket on address, as
+//described with runServer(), and returns it, or -1 after
+//saying what went wrong.
+int openListener(const char *address)
+{
+  bool tcp = address[0] != '\0' && strspn(address, "0123456789") == strlen(address);
+  int fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  int result;
+
+  if(fd < 0)
+    {
+      cerr << "Could not create a socket: " << strerror(errno) << endl;
+      return -1;
+    }
+
+  if(tcp)
+    {
+      sockaddr_in local;
+      int on = 1;
+
+      memset(&local, 0, sizeof(local));
+      local.sin_family = AF_INET;
+      local.sin_port = htons(atoi(address));
+      local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+      result = bind(fd, (sockaddr *) &local, sizeof(local));
+    }
+  else
+    {
+      sockaddr_un local;
+      struct stat info;
+
+      if(strlen(address) >= sizeof(local.sun_path))
+	{
+	  cerr << "Socket path too long: " << address << endl;
+	  close(fd);
+	  return -1;
+	}
+
+      //A socket left behind by an earlier run is in the way,
+      //but anything else at that path is left alone.
+      if(stat(address, &info) == 0 && S_ISSOCK(info.st_mode))
+	unlink(address);
+
+      memset(&local, 0, sizeof(local));
+      local.sun_family = AF_UNIX;
+      strcpy(local.sun_path, address);
+      result = bind(fd, (sockaddr *) &local, sizeof(local));
+    }
+
+  if(result < 0 || listen(fd, SOMAXCONN) < 0)
+    {
+      cerr << "Could not listen on " << address << ": " << strerror(errno) << endl;
+      close(fd);
+      return -1;
+    }
+
+  return fd;
+}
+
+//newBroadcast() encodes text as a broadcast, held once by the
+//caller.  releaseBroadcast() lets go of one hold on broadcast,
+//freeing it if that was the last.
+Broadcast *newBroadcast(Server &server, const string &text)
+{
+  Broadcast *broadcast = (Broadcast *) malloc(sizeof(Broadcast) + text.size());
+
+  broadcast->references = 1;
+  broadcast->length = text.size();
+  memcpy(broadcast->text, text.data(), text.size());
+  server.broadcasts++;
+  server.broadcastBytes += text.size();
+
+  return broadcast;
+}
+
+void releaseBroadcast(Broadcast *broadcast)
+{
+  if(--broadcast->references == 0)
+    free(broadcast);
+}
+
+//flushSession() writes as much of the session's output as the
+//socket will take, and has epoll say when it will take more if
+//it is full.  Its own output goes first, then the broadcasts
+//queued for it, all in one gathering write, straight from
+//where they are, so a broadcast is never copied for a viewer.
+//A reply can therefore overtake broadcasts still queued, but
+//never splits one.
+void flushSession(Server &server, Session &session, int index)
+{
+  while(session.outLength > 0 || session.queueLength > 0)
+    {
+      iovec parts[1 + VIEWER_QUEUE_SIZE];
+      msghdr message;
+      int count = 0;
+
+      if(session.outLength > 0)
+	{
+	  parts[count].iov_base = session.out;
+	  parts[count].iov_len = session.outLength;
+	  count++;
+	}
+
+      for(int i = 0; i < session.queueLength; i++)
+	{
+	  Broadcast *broadcast = session.queued[(session.queueStart + i) % VIEWER_QUEUE_SIZE];
+	  int skip = i == 0 ? session.queueOffset : 0;
+
+	  parts[count].iov_base = broadcast->text + skip;
+	  parts[count].iov_len = broadcast->length - skip;
+	  count++;
+	}
+
+      memset(&message, 0, sizeof(message));
+      message.msg_iov = parts;
+      message.msg_iovlen = count;
+
+      ssize_t n = sendmsg(session.fd, &message, MSG_NOSIGNAL);
+
+      if(n < 0)
+	{
+	  if(errno != EAGAIN && errno != EWOULDBLOCK)
+	    session.closing = true;
+	  break;
+	}
+
+      int sent = min((ssize_t) session.outLength, n);
+
+      session.outLength -= sent;
+      memmove(session.out, session.out + sent, session.outLength);
+      n -= sent;
+
+      while(n > 0)
+	{
+	  Broadcast *broadcast = session.queued[session.queueStart];
+	  int left = broadcast->length - session.queueOffset;
+
+	  if(n < left)
+	    {
+	      session.queueOffset += n;
+	      break;
+	    }
+
+	  n -= left;
+	  releaseBroadcast(broadcast);
+	  session.queueStart = (session.queueStart + 1) % VIEWER_QUEUE_SIZE;
+	  session.queueLength--;
+	  session.queueOffset = 0;
+	}
+    }
+
+  bool waiting = (session.outLength > 0 || session.queueLength > 0) && !session.closing;
+
+  if(waiting != session.waitingToWrite)
+    {
+      epoll_event event;
+
+      event.events = waiting ? EPOLLIN | EPOLLOUT : EPOLLIN;
+      event.data.u64 = index;
+      epoll_ctl(server.epollFd, EPOLL_CTL_MOD, session.fd, &event);
+      session.waitingToWrite = waiting;
+    }
+}
+
+//sendLine() sends text and a newline to a session's client.
+//A client that lets its output back up beyond the buffer is
+//disconnected.
+void sendLine(Server &server, int index, const string &text)
+{
+  Session &session = server.sessions[index];
+
+  if(session.closing)
+    return;
+
+  if(session.outLength + text.size() + 1 > (size_t) SESSION_OUTPUT_SIZE)
+    {
+      session.closing = true;
+      return;
+    }
+
+  memcpy(session.out + session.outLength, text.data(), text.size());
+  session.outLength += text.size();
+  session.out[session.outLength++] = '\n';
+  flushSession(server, session, index);
+}
+
+//Broadcasts to viewers can find them unable to keep up, and
+//then they are closed there and then.
+void closeSession(Server &server, int index);
+
+//queueBroadcast() queues broadcast for the viewer in session
+//index and sends what it can.  A viewer with a full queue is
+//left to be closed.
+void queueBroadcast(Server &server, int index, Broadcast *broadcast)
+{
+  Session &session = server.sessions[index];
+
+  if(session.closing)
+    return;
+
+  if(session.queueLength == VIEWER_QUEUE_SIZE)
+    {
+      session.closing = true;
+      return;
+    }
+
+  broadcast->references++;
+  session.queued[(session.queueStart + session.queueLength) % VIEWER_QUEUE_SIZE] = broadcast;
+  session.queueLength++;
+  server.deliveries++;
+  flushSession(server, session, index);
+}
+
+//fanOut() queues broadcast for every viewer of the game in
+//session index that watches it in mode, or for all of them if
+//mode is -1, and closes those that cannot keep up.
+void fanOut(Server &server, int index, int mode, Broadcast *broadcast)
+{
+  vector<int> behind;
+
+  for(int viewer = server.sessions[index].firstViewer; viewer >= 0; viewer = server.sessions[viewer].nextViewer)
+    if(mode < 0 || server.sessions[viewer].watchMode == mode)
+      {
+	queueBroadcast(server, viewer, broadcast);
+
+	if(server.sessions[viewer].closing)
+	  behind.push_back(viewer);
+      }
+
+  for(size_t i = 0; i < behind.size(); i++)
+    closeSession(server, behind[i]);
+}
+
+//boardText() returns pos's board as drawBoard() draws it.
+string boardText(Position &pos)
+{
+  stringbuf buffer;
+  streambuf *old = cout.rdbuf(&buffer);
+
+  drawBoard(pos.grid);
+  cout.rdbuf(old);
+
+  return buffer.str();
+}
+
+//latestBroadcast() returns the snapshot of the game in session
+//index for a viewer joining now in mode, making it if it has
+//not been made since the game last changed: "game N POSITION"
+//for one watching moves, or "frame N LINES" and that many lines
+//of board for one watching boards, followed by "ended N W" if
+//player W has won.  forgetLatest() throws the snapshots away
+//when the game changes.
+Broadcast *latestBroadcast(Server &server, int index, WatchMode mode)
+{
+  Session &session = server.sessions[index];
+
+  if(session.latest[mode] == NULL)
+    {
+      string text;
+
+      if(mode == WATCH_MOVES)
+	text = "game " + to_string(index) + " " + positionText(session.pos.grid, session.pos.turn) + "\n";
+      else
+	{
+	  string board = boardText(session.pos);
+
+	  text = "frame " + to_string(index) + " " + to_string(count(board.begin(), board.end(), '\n')) + "\n" + board;
+	}
+
+      if(session.over)
+	text += "ended " + to_string(index) + " " + (session.pos.turn == 1 ? '2' : '1') + "\n";
+
+      session.latest[mode] = newBroadcast(server, text);
+    }
+
+  return session.latest[mode];
+}
+
+void forgetLatest(Session &session)
+{
+  for(int mode = 0; mode < 2; mode++)
+    if(session.latest[mode])
+      {
+	releaseBroadcast(session.latest[mode]);
+	session.latest[mode] = NULL;
+      }
+}
+
+//publishGame() sends the viewers of the game in session index
+//the game afresh, when it has been started or resumed.
+//publishMove() sends them move, just played in it, as "played
+//N MOVE" or as the board it leads to.  publishOver() sends
+//them "ended N W" when player W has won it.  Each is encoded
+//once, however many viewers there are.
+void publishGame(Server &server, int index)
+{
+  Session &session = server.sessions[index];
+
+  forgetLatest(session);
+
+  if(session.viewers[WATCH_MOVES])
+    fanOut(server, index, WATCH_MOVES, latestBroadcast(server, index, WATCH_MOVES));
+  if(session.viewers[WATCH_BOARDS])
+    fanOut(server, index, WATCH_BOARDS, latestBroadcast(server, index, WATCH_BOARDS));
+}
+
+void publishMove(Server &server, int index, const Move &move)
+{
+  Session &session = server.sessions[index];
+
+  forgetLatest(session);
+
+  if(session.viewers[WATCH_MOVES])
+    {
+      Broadcast *broadcast = newBroadcast(server, "played " + to_string(index) + " " + moveText(move) + "\n");
+
+      fanOut(server, index, WATCH_MOVES, broadcast);
+      releaseBroadcast(broadcast);
+    }
+
+  //The board doubles as the snapshot for viewers joining
+  //before the next move.
+  if(session.viewers[WATCH_BOARDS])
+    fanOut(server, index, WATCH_BOARDS, latestBroadcast(server, index, WATCH_BOARDS));
+}
+
+void publishOver(Server &server, int index, int winner)
+{
+  Session &session = server.sessions[index];
+
+  forgetLatest(session);
+
+  if(session.firstViewer >= 0)
+    {
+      Broadcast *broadcast = newBroadcast(server, "ended " + to_string(index) + " " + to_string(winner) + "\n");
+
+      fanOut(server, index, -1, broadcast);
+      releaseBroadcast(broadcast);
+    }
+}
+
+//watchGame() makes the session viewer a viewer of the game in
+//session index, in mode, starting it off with the snapshot.
+//unwatchGame() stops viewer watching, if it is.
+void watchGame(Server &server, int viewer, int index, WatchMode mode)
+{
+  Session &session = server.sessions[viewer], &watched = server.sessions[index];
+
+  session.watching = index;
+  session.watchMode = mode;
+  session.prevViewer = -1;
+  session.nextViewer = watched.firstViewer;
+
+  if(watched.firstViewer >= 0)
+    server.sessions[watched.firstViewer].prevViewer = viewer;
+
+  watched.firstViewer = viewer;
+  watched.viewers[mode]++;
+  server.watchers++;
+  queueBroadcast(server, viewer, latestBroadcast(server, index, mode));
+}
+
+void unwatchGame(Server &server, int viewer)
+{
+  Session &session = server.sessions[viewer];
+
+  if(session.watching < 0)
+    return;
+
+  Session &watched = server.sessions[session.watching];
+
+  if(session.prevViewer >= 0)
+    server.sessions[session.prevViewer].nextViewer = session.nextViewer;
+  else
+    watched.firstViewer = session.nextViewer;
+
+  if(session.nextViewer >= 0)
+    server.sessions[session.nextViewer].prevViewer = session.prevViewer;
+
+  watched.viewers[session.watchMode]--;
+  server.watchers--;
+  session.watching = -1;
+}
+
+//askEngine() hands the session's position to the engine
+//threads.
+void askEngine(Server &server, int index)
+{
+  Session &session = server.sessions[index];
+  EngineJob job;
+
+  job.session = index;
+  job.generation = session.generation;
+  job.pos = session.pos;
+  session.thinking = true;
+  session.asked = chrono::steady_clock::now();
+
+  lock_guard<mutex> guard(server.jobLock);
+  server.jobs.push_back(job);
+  server.jobReady.notify_one();
+}
+
+//journalSessionMove() journals move, about to be played in a
+//session, starting the game in the journal first if it is the
+//game's first move there.  Games are journaled from their
+//first move so that clients that connect and never play cost
+//nothing.
+void journalSessionMove(Session &session, const Move &move)
+{
+  if(session.journalGame == 0)
+    session.journalGame = journalStart(session.pos, session.computer, session.history.plies);
+
+  journalMove(session.journalGame, move);
+}
+
+//afterMove() is called whenever a move has been played in a
+//session.  It tells the client if the game is over, and
+//otherwise asks the engine threads for a move if it is the
+//computer's turn.
+void afterMove(Server &server, int index)
+{
+  Session &session = server.sessions[index];
+  Move moves[MAX_MOVES];
+
+  if(generateMoves(session.pos, moves, false) == 0)
+    {
+      session.over = true;
+      journalEnd(session.journalGame, session.pos.turn == 1 ? 2 : 1);
+      session.journalGame = 0;
+      sendLine(server, index, string("over ") + (session.pos.turn == 1 ? '2' : '1'));
+      publishOver(server, index, session.pos.turn == 1 ? 2 : 1);
+    }
+  else if(session.pos.turn == session.computer)
+    askEngine(server, index);
+}
+
+//newGame() starts a new game in a session, with the computer
+//playing player computer (or nobody, if it is 0).
+void newGame(Server &server, int index, int computer)
+{
+  Session &session = server.sessions[index];
+
+  journalEnd(session.journalGame, 0);
+  session.journalGame = 0;
+  session.generation++;
+  startPosition(session.pos);
+  session.history.plies = 0;
+  session.history.length = 0;
+  session.computer = computer;
+  session.thinking = false;
+  session.over = false;
+}
+
+//serverStats() describes how the server has done so far in a
+//line of key=value pairs.
+string serverStats(Server &server)
+{
+  long long percentiles[2] = { 0, 0 };
+  double fractions[2] = { 0.5, 0.99 };
+
+  for(int p = 0; p < 2; p++)
+    {
+      long long counted = 0;
+
+      for(int k = 0; k < LATENCY_BUCKETS && server.engineMoves > 0; k++)
+	{
+	  counted += server.latency[k];
+
+	  if(counted >= fractions[p] * server.engineMoves)
+	    {
+	      percentiles[p] = 1LL << k;
+	      break;
+	    }
+	}
+    }
+
+  string stats = "sessions=" + to_string(server.active) + " max_sessions=" + to_string(server.maxSessions)
+    + " session_bytes=" + to_string(sizeof(Session)) + " connections=" + to_string(server.connections)
+    + " commands=" + to_string(server.commands) + " computer_moves=" + to_string(server.engineMoves)
+    + " latency_mean_us=" + to_string(server.engineMoves ? server.latencyTotal / server.engineMoves : 0)
+    + " latency_p50_us<" + to_string(percentiles[0]) + " latency_p99_us<" + to_string(percentiles[1])
+    + " latency_max_us=" + to_string(server.latencyMax);
+
+  if(server.broadcasts > 0)
+    stats += " watchers=" + to_string(server.watchers) + " broadcasts=" + to_string(server.broadcasts)
+      + " broadcast_bytes=" + to_string(server.broadcastBytes) + " broadcast_sends=" + to_string(server.deliveries);
+
+  if(journal)
+    stats += " journal_records=" + to_string(journal->records.load())
+      + " journal_commits=" + to_string(journal->commits.load());
+
+  return stats;
+}
+
+//handleCommand() carries out one line from a session's client.
+//The commands are:
+//
+//  new [N]     start a new game, with the computer playing
+//              player N (1 or 2) if N is given
+//  move MOVE   play MOVE, written as in "32-41", for the side
+//              to move
+//  board       show the position, as readPosition() reads it
+//  moves       list the legal moves
+//  save        hand out a snapshot of the game, as written by
+//              snapshotText()
+//  resume SNAPSHOT
+//              carry on the game in SNAPSHOT, computer player
+//              included
+//  stats       show the server's statistics
+//  id          give the session's number, for others to watch
+//  watch N [moves|boards]
+//              follow session N's game, as moves (the default)
+//              or as drawn boards, instead of playing
+//  unwatch     stop following
+//  quit        close the connection
+//
+//Each is answered with one line, starting with "ok", "board",
+//"moves", "snapshot", "stats", "id" or "error".  The server also sends "ready"
+//and the position when a client connects, "move" and the move
+//when the computer moves, and "over N" when player N has won.
+//A viewer is sent where the game stands when it starts
+//watching, then "game N POSITION" for a new game, "played N
+//MOVE" or "frame N LINES" and the board after each move, "ended
+//N W" when player W has won and "closed N" when the session
+//goes.
+void handleCommand(Server &server, int index, char *line)
+{
+  Session &session = server.sessions[index];
+  char *argument = line + strcspn(line, " ");
+
+  if(*argument != '\0')
+    *argument++ = '\0';
+
+  server.commands++;
+
+  if(strcmp(line, "new") == 0)
+    {
+      if(strcmp(argument, "") != 0 && strcmp(argument, "1") != 0 && strcmp(argument, "2") != 0)
+	{
+	  sendLine(server, index, "error the computer can only play player 1 or 2");
+	  return;
+	}
+
+      newGame(server, index, atoi(argument));
+      sendLine(server, index, "ok " + positionText(session.pos.grid, session.pos.turn));
+      publishGame(server, index);
+
+      if(session.computer == 1)
+	askEngine(server, index);
+    }
+  else if(strcmp(line, "move") == 0)
+    {
+      Move move;
+
+      if(session.over)
+	sendLine(server, index, "error the game is over");
+      else if(session.thinking || session.pos.turn == session.computer)
+	sendLine(server, index, "error it is the computer's turn");
+      else if(!readMove(argument, move) || findMove(session.pos, move) < 0)
+	sendLine(server, index, string("error illegal move ") + argument);
+      else
+	{
+	  journalSessionMove(session, move);
+	  makeMove(session.pos, move);
+	  recordMove(session.history, move);
+	  sendLine(server, index, "ok " + moveText(move));
+	  publishMove(server, index, move);
+	  afterMove(server, index);
+	}
+    }
+  else if(strcmp(line, "board") == 0)
+    sendLine(server, index, "board " + positionText(session.pos.grid, session.pos.turn));
+  else if(strcmp(line, "moves") == 0)
+    {
+      Move moves[MAX_MOVES];
+      int count = generateMoves(session.pos, moves, false);
+      string text = "moves";
+
+      for(int i = 0; i < count; i++)
+	text += " " + moveText(moves[i]);
+
+      sendLine(server, index, text);
+    }
+  else if(strcmp(line, "save") == 0)
+    {
+      Snapshot snapshot;
+
+      saveSnapshot(session.pos, session.computer, session.history, snapshot);
+      sendLine(server, index, "snapshot " + snapshotText(snapshot));
+    }
+  else if(strcmp(line, "resume") == 0)
+    {
+      Snapshot snapshot;
+      Position pos;
+      GameHistory history;
+      int computer;
+
+      if(!readSnapshotText(argument, snapshot) || !loadSnapshot(snapshot, pos, computer, history))
+	{
+	  sendLine(server, index, "error bad snapshot");
+	  return;
+	}
+
+      newGame(server, index, computer);
+      session.pos = pos;
+      session.history = history;
+      sendLine(server, index, "ok " + positionText(session.pos.grid, session.pos.turn));
+      publishGame(server, index);
+      afterMove(server, index);
+    }
+  else if(strcmp(line, "id") == 0)
+    sendLine(server, index, "id " + to_string(index));
+  else if(strcmp(line, "watch") == 0)
+    {
+      char *mode = argument + strcspn(argument, " ");
+      int watched = atoi(argument);
+
+      if(*mode != '\0')
+	*mode++ = '\0';
+
+      if(*argument == '\0' || strlen(argument) > 9 || strspn(argument, "0123456789") != strlen(argument)
+	 || watched >= server.maxSessions || server.sessions[watched].fd < 0 || watched == index)
+	sendLine(server, index, string("error no game ") + argument + " to watch");
+      else if(strcmp(mode, "") != 0 && strcmp(mode, "moves") != 0 && strcmp(mode, "boards") != 0)
+	sendLine(server, index, string("error games are watched as moves or boards, not ") + mode);
+      else
+	{
+	  unwatchGame(server, index);
+	  sendLine(server, index, "ok watching " + to_string(watched));
+	  watchGame(server, index, watched, strcmp(mode, "boards") == 0 ? WATCH_BOARDS : WATCH_MOVES);
+	}
+    }
+  else if(strcmp(line, "unwatch") == 0)
+    {
+      unwatchGame(server, index);
+      sendLine(server, index, "ok");
+    }
+  else if(strcmp(line, "stats") == 0)
+    sendLine(server, index, "stats " + serverStats(server));
+  else if(strcmp(line, "quit") == 0)
+    session.closing = true;
+  else
+    sendLine(server, index, string("error unknown command ") + line);
+}
+
+//closeSession() closes a session's connection and returns it
+//to the pool.  A computer move still being worked out for it
+//will be thrown away.  Its game's viewers are sent "closed N"
+//and stop watching it.
+void closeSession(Server &server, int index)
+{
+  Session &session = server.sessions[index];
+  vector<int> audience;
+
+  journalEnd(session.journalGame, 0);
+  session.journalGame = 0;
+  unwatchGame(server, index);
+  epoll_ctl(server.epollFd, EPOLL_CTL_DEL, session.fd, NULL);
+  close(session.fd);
+  session.fd = -1;
+  session.generation++;
+  session.next = server.freeList;
+  server.freeList = index;
+  server.active--;
+
+  for(int viewer = session.firstViewer; viewer >= 0; viewer = server.sessions[viewer].nextViewer)
+    {
+      audience.push_back(viewer);
+      server.sessions[viewer].watching = -1;
+      server.watchers--;
+    }
+
+  session.firstViewer = -1;
+  session.viewers[WATCH_MOVES] = 0;
+  session.viewers[WATCH_BOARDS] = 0;
+  forgetLatest(session);
+
+  for(; session.queueLength > 0; session.queueLength--)
+    {
+      releaseBroadcast(session.queued[session.queueStart]);
+      session.queueStart = (session.queueStart + 1) % VIEWER_QUEUE_SIZE;
+    }
+
+  if(!audience.empty())
+    {
+      Broadcast *broadcast = newBroadcast(server, "closed " + to_string(index) + "\n");
+
+      for(size_t i = 0; i < audience.size(); i++)
+	queueBroadcast(server, audience[i], broadcast);
+
+      releaseBroadcast(broadcast);
+
+      for(size_t i = 0; i < audience.size(); i++)
+	if(server.sessions[audience[i]].closing && server.sessions[audience[i]].fd >= 0)
+	  closeSession(server, audience[i]);
+    }
+}
+
+//openSession() takes a session from the pool for a newly
+//accepted connection, or turns the client away if there is
+//none left.
+void openSession(Server &server, int fd)
+{
+  if(server.freeList < 0)
+    {
+      static const char full[] = "error the server is full\n";
+
+      send(fd, full, sizeof(full) - 1, MSG_NOSIGNAL);
+      close(fd);
+      return;
+    }
+
+  int index = server.freeList;
+  Session &session = server.sessions[index];
+  epoll_event event;
+
+  server.freeList = session.next;
+  server.active++;
+  server.connections++;
+
+  session.fd = fd;
+  session.closing = false;
+  session.waitingToWrite = false;
+  session.inLength = 0;
+  session.outLength = 0;
+  session.watching = -1;
+  session.queueStart = 0;
+  session.queueLength = 0;
+  session.queueOffset = 0;
+  session.firstViewer = -1;
+  newGame(server, index, 0);
+
+  event.events = EPOLLIN;
+  event.data.u64 = index;
+  epoll_ctl(server.epollFd, EPOLL_CTL_ADD, fd, &event);
+
+  sendLine(server, index, "ready " + positionText(session.pos.grid, session.pos.turn));
+
+  if(session.closing)
+    closeSession(server, index);
+}
+
+//readSession() reads what a session's client has sent and
+//carries out every complete line of it.
+void readSession(Server &server, int index)
+{
+  Session &session = server.sessions[index];
+
+  while(!session.closing)
+    {
+      ssize_t n = read(session.fd, session.in + session.inLength, SESSION_INPUT_SIZE - session.inLength);
+
+      if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	break;
+
+      if(n <= 0)
+	{
+	  session.closing = true;
+	  break;
+	}
+
+      char *start = session.in, *end = session.in + session.inLength + n;
+      char *newline;
+
+      while(!session.closing && (newline = (char *) memchr(start, '\n', end - start)) != NULL)
+	{
+	  *newline = '\0';
+
+	  if(newline > start && newline[-1] == '\r')
+	    newline[-1] = '\0';
+
+	  handleCommand(server, index, start);
+	  start = newline + 1;
+	}
+
+      session.inLength = end - start;
+      memmove(session.in, start, session.inLength);
+
+      if(session.inLength == SESSION_INPUT_SIZE)
+	{
+	  sendLine(server, index, "error line too long");
+	  session.closing = true;
+	}
+    }
+}
+
+//finishEngineMoves() plays the moves the engine threads have
+//found in the sessions that still want them.
+void finishEngineMoves(Server &server)
+{
+  eventfd_t count;
+  vector<EngineJob> done;
+
+  eventfd_read(server.wakeFd, &count);
+
+  {
+    lock_guard<mutex> guard(server.jobLock);
+    done.swap(server.results);
+  }
+
+  for(size_t i = 0; i < done.size(); i++)
+    {
+      int index = done[i].session;
+      Session &session = server.sessions[index];
+
+      if(session.fd < 0 || session.generation != done[i].generation)
+	continue;
+
+      long long micros = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - session.asked).count();
+      int bucket = 0;
+
+      while(bucket < LATENCY_BUCKETS - 1 && micros >= (1LL << bucket))
+	bucket++;
+
+      server.engineMoves++;
+      server.latencyTotal += micros;
+      server.latencyMax = max(server.latencyMax, micros);
+      server.latency[bucket]++;
+
+      session.thinking = false;
+      journalSessionMove(session, done[i].move);
+      makeMove(session.pos, done[i].move);
+      recordMove(session.history, done[i].move);
+      sendLine(server, index, "move " + moveText(done[i].move));
+      publishMove(server, index, done[i].move);
+      afterMove(server, index);
+
+      if(session.closing)
+	closeSession(server, index);
+    }
+}
+
+void serverEngineWorker(Server &server, Engine &engine, int index)
+{
+  TRACE_SCOPE("engine thread");
+
+  placeThread(index);
+
+  while(true)
+    {
+      EngineJob job;
+
+      {
+	unique_lock<mutex> guard(server.jobLock);
+
+	while(!server.stopping && server.jobs.empty())
+	  server.jobReady.wait(guard);
+
+	if(server.stopping)
+	  return;
+
+	job = server.jobs.front();
+	server.jobs.pop_front();
+      }
+
+      think(engine, job.pos, job.move);
+
+      {
+	lock_guard<mutex> guard(server.jobLock);
+	server.results.push_back(job);
+      }
+
+      eventfd_write(server.wakeFd, 1);
+    }
+}
+
+void runServer(const char *address, const EngineConfig &config, int threads, int maxSessions)
+{
+  Server server;
+  sigset_t signals;
+  rlimit files;
+
+  server.sessions = (Session *) allocateBlock(maxSessions * sizeof(Session), "sessions");
+  server.maxSessions = maxSessions;
+  server.freeList = 0;
+  server.active = 0;
+  server.stopping = false;
+  server.connections = server.commands = server.engineMoves = 0;
+  server.latencyTotal = server.latencyMax = 0;
+  server.watchers = 0;
+  server.broadcasts = server.broadcastBytes = server.deliveries = 0;
+
+  for(int k = 0; k < LATENCY_BUCKETS; k++)
+    server.latency[k] = 0;
+
+  for(int i = 0; i < maxSessions; i++)
+    {
+      server.sessions[i].fd = -1;
+      server.sessions[i].next = i + 1 < maxSessions ? i + 1 : -1;
+      server.sessions[i].generation = 0;
+    }
+
+  EngineConfig fitted = config;
+
+  if(memoryBudget && !fitEngine(fitted, arenaAvailable() / threads))
+    {
+      cerr << "The memory budget is too small for " << threads << " engine threads" << endl;
+      return;
+    }
+
+  //Every session needs a descriptor, so allow as many as the
+  //system will.
+  if(getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max)
+    {
+      files.rlim_cur = files.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+  //Ctrl-C and kill stop the server through the epoll loop,
+  //rather than killing it, so that it can report.  They are
+  //blocked before any thread starts, so that every thread
+  //inherits the block.
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+  server.listenFd = openListener(address);
+
+  if(server.listenFd < 0)
+    return;
+
+  server.epollFd = epoll_create1(EPOLL_CLOEXEC);
+  server.wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  server.signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC);
+
+  unsigned long long tags[3] = { LISTEN_TAG, WAKE_TAG, SIGNAL_TAG };
+  int fds[3] = { server.listenFd, server.wakeFd, server.signalFd };
+
+  for(int i = 0; i < 3; i++)
+    {
+      epoll_event event;
+
+      event.events = EPOLLIN;
+      event.data.u64 = tags[i];
+      epoll_ctl(server.epollFd, EPOLL_CTL_ADD, fds[i], &event);
+    }
+
+  unique_ptr<Engine[]> engines(new Engine[threads]);
+  vector<thread> workers;
+
+  for(int i = 0; i < threads; i++)
+    {
+      initEngine(engines[i], fitted);
+      workers.push_back(thread(serverEngineWorker, ref(server), ref(engines[i]), i));
+    }
+
+  cerr << "Serving on " << address << ": up to " << maxSessions << " sessions of " << sizeof(Session)
+       << " bytes each, " << threads << " engine threads" << endl;
+
+  const int MAX_EVENTS = 256;
+  epoll_event events[MAX_EVENTS];
+  bool running = true;
+
+  while(running)
+    {
+      int count = epoll_wait(server.epollFd, events, MAX_EVENTS, -1);
+
+      if(count < 0 && errno != EINTR)
+	{
+	  cerr << "epoll_wait failed: " << strerror(errno) << endl;
+	  break;
+	}
+
+      for(int e = 0; e < count; e++)
+	{
+	  unsigned long long tag = events[e].data.u64;
+
+	  if(tag == SIGNAL_TAG)
+	    running = false;
+	  else if(tag == WAKE_TAG)
+	    finishEngineMoves(server);
+	  else if(tag == LISTEN_TAG)
+	    {
+	      int fd;
+
+	      while((fd = accept4(server.listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+		openSession(server, fd);
+	    }
+	  else
+	    {
+	      int index = tag;
+	      Session &session = server.sessions[index];
+
+	      //An earlier event in this batch may have closed it.
+	      if(session.fd < 0)
+		continue;
+
+	      if(events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+		readSession(server, index);
+	      if(events[e].events & EPOLLOUT)
+		flushSession(server, session, index);
+	      if(session.closing)
+		closeSession(server, index);
+	    }
+	}
+    }
+
+  {
+    lock_guard<mutex> guard(server.jobLock);
+    server.stopping = true;
+    server.jobReady.notify_all();
+  }
+
+  for(int i = 0; i < threads; i++)
+    workers[i].join();
+
+  for(int i = 0; i < maxSessions; i++)
+    {
+      if(server.sessions[i].fd >= 0)
+	closeSession(server, i);
+    }
+
+  close(server.listenFd);
+  close(server.wakeFd);
+  close(server.signalFd);
+  close(server.epollFd);
+
+  if(strspn(address, "0123456789") != strlen(address))
+    unlink(address);
+
+  cerr << "\n" << serverStats(server) << endl;
+}
+#endif
+
+#ifdef CHECKERS_FUZZ
+//Building with -DCHECKERS_FUZZ and clang's -fsanitize=fuzzer
+//makes the program a libFuzzer target for replayGame() and
+//checkMove(), which checks every game it is given against
+//findMove().
+
+//listedMove() plays move in pos if findMove() finds it: the
+//slow but sure way that checkMove() must agree with.
+bool listedMove(Position &pos, const Move &move)
+{
+  if(findMove(pos, move) < 0)
+    return false;
+
+  makeMove(pos, move);
+  return true;
+}
+
+//fuzzGame() turns the fuzzer's bytes into a game.  A byte
+//picks one of the legal moves, so that games get well into
+//the middle game, except for 255, which makes up a move from
+//the next three bytes: the first picks one of the mover's
+//pieces, the second the square, anywhere on the board, that it
+//goes to first (bits 0-5) and how many jumps follow (bits 6-7),
+//and the third which way each of those goes.  Made-up moves may
+//run off the board, which makes words replayGame() cannot
+//read.  The game ends at the first illegal move.
+string fuzzGame(const unsigned char *data, size_t size)
+{
+  static const int directions[4][2] = { {1, 1}, {1, -1}, {-1, 1}, {-1, -1} };
+  Position pos;
+  string text;
+  size_t i = 0;
+
+  startPosition(pos);
+
+  while(i < size)
+    {
+      Move move;
+
+      if(data[i] != 255)
+	{
+	  Move moves[MAX_MOVES];
+	  int count = generateMoves(pos, moves, false);
+
+	  if(count == 0)
+	    break;
+
+	  move = moves[data[i++] % count];
+	}
+      else if(i + 3 < size)
+	{
+	  int pieces[32][2], count = 0;
+	  int piece = data[i + 1], first = data[i + 2], rest = data[i + 3];
+
+	  i += 4;
+
+	  for(int x = 0; x < 8; x++)
+	    for(int y = 0; y < 8; y++)
+	      if(pos.grid[x][y] == pos.turn || pos.grid[x][y] == pos.turn + 2)
+		{
+		  pieces[count][0] = x;
+		  pieces[count][1] = y;
+		  count++;
+		}
+
+	  if(count == 0)
+	    break;
+
+	  move.path[0][0] = pieces[piece % count][0];
+	  move.path[0][1] = pieces[piece % count][1];
+	  move.path[1][0] = (first & 63) / 8;
+	  move.path[1][1] = first % 8;
+	  move.length = 2;
+
+	  for(int j = 0; j < first >> 6; j++)
+	    {
+	      int d = rest >> (2 * j) & 3;
+
+	      move.path[move.length][0] = move.path[move.length - 1][0] + directions[d][0] * 2;
+	      move.path[move.length][1] = move.path[move.length - 1][1] + directions[d][1] * 2;
+	      move.length++;
+	    }
+	}
+      else
+	break;
+
+      text += (text.empty() ? "" : " ") + moveText(move);
+
+      if(!listedMove(pos, move))
+	break;
+    }
+
+  return text;
+}
+
+//fuzzReplay() replays text with checkMove() and with
+//listedMove(), and stops the program if they disagree.
+void fuzzReplay(const string &text)
+{
+  vector<char> line(text.begin(), text.end());
+  Position fast, slow;
+  char *fastBad, *slowBad;
+
+  line.push_back('\0');
+
+  int fastPlayed = replayGame(&line[0], fast, fastBad, checkMove);
+  int slowPlayed = replayGame(&line[0], slow, slowBad, listedMove);
+
+  //An illegal move leaves checkMove()'s position in an unknown
+  //state, so positions are only compared after a whole game.
+  if(fastPlayed != slowPlayed || fastBad != slowBad
+     || (fastBad == NULL && (memcmp(fast.grid, slow.grid, sizeof(fast.grid)) != 0 || fast.turn != slow.turn
+			     || fast.p1Pieces != slow.p1Pieces || fast.p2Pieces != slow.p2Pieces)))
+    {
+      cerr << "checkMove() and findMove() disagree about: " << text << endl;
+      abort();
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size)
+{
+  fuzzReplay(fuzzGame(data, size));
+  fuzzReplay(string((const char *) data, size));
+
+  return 0;
+}
+#endif